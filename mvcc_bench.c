@@ -0,0 +1,802 @@
+/*--------------------------------------------------------------------------------
+ * This is a benchmark for the MVCC engine - like a stopwatch for a race.
+ * Unlike mvcc_main.c it never waits for ENTER: it runs a workload for a
+ * while and prints the results as JSON, so they can be saved and compared.
+ *
+ * Workloads:
+ *   ycsb       - Each transaction either reads or read-modify-writes a few
+ *                keys, picked uniformly or with Zipfian skew (hot keys).
+ *   tpcc-lite  - A "payment"-like transaction: update one warehouse, one
+ *                of its districts and one customer. Warehouses and
+ *                districts are few, so they are very hot.
+ *
+ * Usage: ./mvcc_bench [options]   (./mvcc_bench --help for the list)
+ * ---------------------------------------------------------------------------------
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mvcc_types.h"
+#include "mvcc_transaction_manager.h"
+#include "mvcc_visibility.h"
+#include "mvcc_table.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <threads.h>
+#include <time.h>
+
+// ----------------------------------------------------------------------------
+// CONFIGURATION
+// ----------------------------------------------------------------------------
+typedef enum {
+    WORKLOAD_YCSB,
+    WORKLOAD_TPCC_LITE
+} Workload;
+
+typedef struct {
+    Workload workload;
+    MvccMode mode;
+    int threads;
+    int shards;            // Transaction manager shards (one per socket)
+    int duration_ms;
+    int keys;              // Rows in the table
+    int read_pct;          // % of transactions that only read (ycsb)
+    int ops_per_tx;        // Keys touched per transaction (ycsb)
+    double zipf_theta;     // 0 = uniform, 0.99 = YCSB's default skew
+    int chain_length;      // Versions per row built before the run (readers
+                           // keep a snapshot from before, so they walk them)
+    bool long_reader;      // Keep one snapshot open for the whole run
+    bool read_only_begin;  // Use the read-only fast path for readers
+    int vacuum_ms;         // Vacuum every N ms (0 = never)
+    int idle_timeout_ms;   // Terminate idle old snapshots (0 = never)
+    int warehouses;        // tpcc-lite: number of warehouses
+    int payload_bytes;     // > 0: rows get a text column this long
+    uint64_t seed;
+    const char* metrics_file;  // Prometheus dump at the end (optional)
+} BenchConfig;
+
+BenchConfig config = {
+    .workload = WORKLOAD_YCSB,
+    .mode = MVCC_MODE_XID,
+    .threads = 4,
+    .shards = 1,
+    .duration_ms = 1000,
+    .keys = 1000,
+    .read_pct = 90,
+    .ops_per_tx = 4,
+    .zipf_theta = 0.0,
+    .chain_length = 1,
+    .long_reader = false,
+    .read_only_begin = true,
+    .vacuum_ms = 10,
+    .idle_timeout_ms = 0,
+    .warehouses = 4,
+    .payload_bytes = 0,
+    .seed = 42,
+    .metrics_file = NULL,
+};
+
+// ----------------------------------------------------------------------------
+// RANDOM NUMBERS
+// ----------------------------------------------------------------------------
+// xorshift64*: small, fast, and every thread gets its own seed
+uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+double next_unit(uint64_t* state) {
+    return (double)(next_random(state) >> 11) / (double)(1ull << 53);
+}
+
+// ----------------------------------------------------------------------------
+// ZIPFIAN KEYS
+// ----------------------------------------------------------------------------
+// Some keys are MUCH more popular than others (like a few songs that
+// everybody plays). This is the generator YCSB uses (Gray et al.).
+typedef struct {
+    int n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} Zipf;
+
+void init_zipf(Zipf* z, int n, double theta) {
+    z->n = n;
+    z->theta = theta;
+    double zeta2 = 0.0;
+    z->zetan = 0.0;
+    for (int i = 1; i <= n; i++) {
+        z->zetan += 1.0 / pow((double)i, theta);
+        if (i == 2) {
+            zeta2 = z->zetan;
+        }
+    }
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+int next_key(Zipf* z, uint64_t* state) {
+    if (z->theta <= 0.0) {
+        return (int)(next_random(state) % (uint64_t)z->n);
+    }
+    double u = next_unit(state);
+    double uz = u * z->zetan;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + pow(0.5, z->theta)) {
+        return 1;
+    }
+    int key = (int)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return key < z->n ? key : z->n - 1;
+}
+
+// ----------------------------------------------------------------------------
+// LATENCY HISTOGRAMS
+// ----------------------------------------------------------------------------
+// Power-of-two buckets, like the engine's own histograms (mvcc_metrics.h).
+// A run of any length needs the same few hundred bytes per worker, so
+// max_rss_kb is the engine's memory, not a pile of our samples.
+typedef struct {
+    HistogramSnapshot histogram;
+    uint64_t max;
+} Latencies;
+
+void add_latency(Latencies* l, uint64_t ns) {
+    l->histogram.buckets[histogram_bucket(ns)]++;
+    l->histogram.count++;
+    l->histogram.sum += ns;
+    if (ns > l->max) {
+        l->max = ns;
+    }
+}
+
+void merge_latencies(Latencies* into, const Latencies* from) {
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        into->histogram.buckets[b] += from->histogram.buckets[b];
+    }
+    into->histogram.count += from->histogram.count;
+    into->histogram.sum += from->histogram.sum;
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+}
+
+// The p-th latency is at most this: the top of its bucket, but never
+// more than the slowest one we saw
+uint64_t latency_percentile_le(const Latencies* l, double p) {
+    uint64_t limit = histogram_percentile(&l->histogram, p);
+    return limit < l->max ? limit : l->max;
+}
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ----------------------------------------------------------------------------
+// PER-THREAD RESULTS
+// ----------------------------------------------------------------------------
+typedef struct {
+    int id;
+    uint64_t seed;
+    uint64_t committed;
+    uint64_t aborted;
+    uint64_t ops;
+    Latencies read_latency;
+    Latencies update_latency;
+
+    // With --chain-length: this worker's reader, started before the
+    // preload built the chains (NULL = none, or it was terminated)
+    Transaction* chain_reader;
+} WorkerState;
+
+_Atomic bool stop_flag;
+Zipf key_dist;
+
+// ----------------------------------------------------------------------------
+// READ / WRITE ONE KEY
+// ----------------------------------------------------------------------------
+// With --payload-bytes the rows are (id, counter, payload) and we only
+// ever touch the counter, so the payload should be shared, never copied.
+#define COUNTER_COLUMN 1
+
+bool bench_read(Transaction* tx, int key, int32_t* value) {
+    if (config.payload_bytes == 0) {
+        return read_tuple(tx, key, value);
+    }
+    Value column;
+    if (!read_column(tx, key, COUNTER_COLUMN, &column, NULL, 0)) {
+        return false;
+    }
+    *value = (int32_t)column.number;
+    return true;
+}
+
+bool bench_write(Transaction* tx, int key, int32_t value) {
+    if (config.payload_bytes == 0) {
+        return update_tuple(tx, key, value);
+    }
+    int column = COUNTER_COLUMN;
+    Value counter = {.type = COL_INT32, .number = value};
+    return update_columns(tx, key, &column, &counter, 1);
+}
+
+// ----------------------------------------------------------------------------
+// START / END ONE BENCHMARK TRANSACTION
+// ----------------------------------------------------------------------------
+// With --chain-length, reads go through the worker's chain reader, whose
+// snapshot is older than every preloaded version - so every read walks
+// the whole chain, like a long report running next to the updates.
+Transaction* begin_bench_transaction(WorkerState* w, bool is_read) {
+    if (is_read && w->chain_reader) {
+        return w->chain_reader;
+    }
+    return is_read && config.read_only_begin
+        ? begin_read_only_transaction()
+        : begin_transaction();
+}
+
+// The chain reader stays open until the end of the run - unless a read
+// failed (it was terminated for idling), then we carry on without it
+void end_bench_transaction(WorkerState* w, Transaction* tx, bool ok) {
+    if (tx == w->chain_reader) {
+        if (!ok) {
+            commit_transaction(tx);  // Or just find out it was terminated
+            w->chain_reader = NULL;
+        }
+    } else if (ok) {
+        commit_transaction(tx);
+    } else {
+        abort_transaction(tx);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// ONE YCSB TRANSACTION
+// ----------------------------------------------------------------------------
+// Returns true if it committed
+bool run_ycsb_transaction(WorkerState* w, bool* is_read) {
+    *is_read = (int)(next_random(&w->seed) % 100) < config.read_pct;
+
+    Transaction* tx = begin_bench_transaction(w, *is_read);
+    if (!tx) {
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < config.ops_per_tx && ok; i++) {
+        int key = next_key(&key_dist, &w->seed);
+        int32_t value = 0;
+        w->ops++;
+        ok = bench_read(tx, key, &value) &&
+             (*is_read || bench_write(tx, key, value + 1));  // Or someone
+    }                                                        // got there first
+    end_bench_transaction(w, tx, ok);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// ONE TPC-C-LITE TRANSACTION
+// ----------------------------------------------------------------------------
+// Table layout: [warehouses][10 districts per warehouse][customers...]
+bool run_tpcc_transaction(WorkerState* w, bool* is_read) {
+    int warehouses = config.warehouses;
+    int districts = warehouses * 10;
+    int customers = config.keys - warehouses - districts;
+
+    int warehouse = (int)(next_random(&w->seed) % (uint64_t)warehouses);
+    int district = warehouses + warehouse * 10 +
+                   (int)(next_random(&w->seed) % 10);
+    int customer = warehouses + districts +
+                   next_key(&key_dist, &w->seed) % customers;
+    int keys[3] = {warehouse, district, customer};
+
+    // A small share are "order status" lookups that only read
+    *is_read = (int)(next_random(&w->seed) % 100) < config.read_pct;
+    Transaction* tx = begin_bench_transaction(w, *is_read);
+    if (!tx) {
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < 3 && ok; i++) {
+        int32_t value = 0;
+        w->ops++;
+        ok = bench_read(tx, keys[i], &value) &&
+             (*is_read || bench_write(tx, keys[i], value + 1));
+    }
+    end_bench_transaction(w, tx, ok);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// WORKER THREAD
+// ----------------------------------------------------------------------------
+int worker_main(void* arg) {
+    WorkerState* w = (WorkerState*)arg;
+    bind_thread_to_shard(w->id % config.shards);
+
+    while (!atomic_load_explicit(&stop_flag, memory_order_relaxed)) {
+        bool is_read = false;
+        uint64_t start = now_ns();
+        bool ok = config.workload == WORKLOAD_YCSB
+            ? run_ycsb_transaction(w, &is_read)
+            : run_tpcc_transaction(w, &is_read);
+        uint64_t elapsed = now_ns() - start;
+
+        if (ok) {
+            w->committed++;
+            add_latency(is_read ? &w->read_latency : &w->update_latency, elapsed);
+        } else {
+            w->aborted++;
+        }
+    }
+
+    epoch_unregister_thread();
+    metrics_unregister_thread();
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// VACUUM THREAD
+// ----------------------------------------------------------------------------
+uint64_t vacuum_passes = 0;
+uint64_t vacuum_removed = 0;
+uint64_t snapshots_terminated = 0;
+
+int vacuum_main(void* arg) {
+    (void)arg;
+    struct timespec pause = {
+        .tv_sec = config.vacuum_ms / 1000,
+        .tv_nsec = (long)(config.vacuum_ms % 1000) * 1000000L,
+    };
+
+    while (!atomic_load(&stop_flag)) {
+        int total_versions;
+        if (config.idle_timeout_ms > 0) {
+            snapshots_terminated += (uint64_t)abort_idle_snapshots(
+                (uint64_t)config.idle_timeout_ms * 1000000ull);
+        }
+        vacuum_removed += (uint64_t)vacuum_pass(&total_versions);
+        vacuum_passes++;
+        thrd_sleep(&pause, NULL);
+    }
+
+    epoch_unregister_thread();
+    metrics_unregister_thread();
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// SETUP
+// ----------------------------------------------------------------------------
+// Fill the table, then update every row until it has chain_length versions.
+// Each worker's chain reader starts in between, so the versions stay in
+// its way: vacuum can't cut them, and every read it does walks them all.
+bool load_table(WorkerState* workers) {
+    char* payload = NULL;
+    if (config.payload_bytes > 0) {
+        Column columns[] = {
+            {"id", COL_INT64},
+            {"counter", COL_INT32},
+            {"payload", COL_TEXT},
+        };
+        set_table_schema(columns, 3);
+        payload = (char*)malloc((size_t)config.payload_bytes);
+        if (!payload) {
+            return false;
+        }
+        memset(payload, 'x', (size_t)config.payload_bytes);
+    }
+
+    Transaction* tx = begin_transaction();
+    for (int i = 0; i < config.keys; i++) {
+        bool ok;
+        if (payload) {
+            Value row[] = {
+                {.type = COL_INT64, .number = i},
+                {.type = COL_INT32, .number = 0},
+                {.type = COL_TEXT, .text = payload,
+                 .length = (uint32_t)config.payload_bytes},
+            };
+            ok = insert_row(tx, row);
+        } else {
+            ok = insert_tuple(tx, 0);
+        }
+        if (!ok) {
+            abort_transaction(tx);
+            free(payload);
+            return false;
+        }
+    }
+    commit_transaction(tx);
+    free(payload);
+
+    for (int i = 0; i < config.threads && config.chain_length > 1; i++) {
+        workers[i].chain_reader = begin_read_only_transaction();
+    }
+    for (int v = 1; v < config.chain_length; v++) {
+        tx = begin_transaction();
+        for (int i = 0; i < config.keys; i++) {
+            bench_write(tx, i, 0);
+        }
+        commit_transaction(tx);
+    }
+    return true;
+}
+
+// Done with the chain readers (the run is over, or never started)
+void end_chain_readers(WorkerState* workers) {
+    for (int i = 0; i < config.threads; i++) {
+        if (workers[i].chain_reader) {
+            commit_transaction(workers[i].chain_reader);
+            workers[i].chain_reader = NULL;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// COMMAND LINE
+// ----------------------------------------------------------------------------
+void print_usage() {
+    printf("Usage: mvcc_bench [options]\n");
+    printf("  --workload ycsb|tpcc-lite  Workload to run (default ycsb)\n");
+    printf("  --mode xid|ts              MVCC mode (default xid)\n");
+    printf("  --threads N                Worker threads (default 4)\n");
+    printf("  --shards N                 Transaction manager shards, at most %d\n", MAX_TX_SHARDS);
+    printf("                             (default 1; worker i uses shard i %% N)\n");
+    printf("  --duration-ms N            Run time (default 1000)\n");
+    printf("  --keys N                   Rows, at most %d (default 1000)\n", MAX_TUPLES);
+    printf("  --read-pct N               %% read-only transactions (default 90)\n");
+    printf("  --ops-per-tx N             Keys per ycsb transaction (default 4)\n");
+    printf("  --zipf THETA               Key skew, 0 <= THETA < 1, 0 = uniform (default 0)\n");
+    printf("  --chain-length N           Versions per row before the run; reads use\n");
+    printf("                             a snapshot from before them (default 1)\n");
+    printf("  --long-reader              Hold one snapshot open during the run\n");
+    printf("  --no-read-only-begin       Readers use begin_transaction()\n");
+    printf("  --vacuum-ms N              Vacuum interval, 0 = off (default 10)\n");
+    printf("  --idle-timeout-ms N        Before each vacuum, terminate snapshots\n");
+    printf("                             idle this long, 0 = off (default 0)\n");
+    printf("  --warehouses N             tpcc-lite warehouses (default 4)\n");
+    printf("  --payload-bytes N          Give rows a text column this long\n");
+    printf("  --seed N                   Random seed (default 42)\n");
+    printf("  --metrics-file PATH        Also write engine metrics (Prometheus)\n");
+}
+
+bool parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--help") == 0) {
+            print_usage();
+            exit(0);
+        } else if (strcmp(arg, "--long-reader") == 0) {
+            config.long_reader = true;
+            continue;
+        } else if (strcmp(arg, "--no-read-only-begin") == 0) {
+            config.read_only_begin = false;
+            continue;
+        }
+
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+        i++;
+
+        if (strcmp(arg, "--workload") == 0) {
+            if (strcmp(value, "ycsb") == 0) {
+                config.workload = WORKLOAD_YCSB;
+            } else if (strcmp(value, "tpcc-lite") == 0) {
+                config.workload = WORKLOAD_TPCC_LITE;
+            } else {
+                fprintf(stderr, "Unknown workload: %s\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--mode") == 0) {
+            if (strcmp(value, "xid") == 0) {
+                config.mode = MVCC_MODE_XID;
+            } else if (strcmp(value, "ts") == 0) {
+                config.mode = MVCC_MODE_TIMESTAMP;
+            } else {
+                fprintf(stderr, "Unknown mode: %s\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--threads") == 0) {
+            config.threads = atoi(value);
+        } else if (strcmp(arg, "--shards") == 0) {
+            config.shards = atoi(value);
+        } else if (strcmp(arg, "--duration-ms") == 0) {
+            config.duration_ms = atoi(value);
+        } else if (strcmp(arg, "--keys") == 0) {
+            config.keys = atoi(value);
+        } else if (strcmp(arg, "--read-pct") == 0) {
+            config.read_pct = atoi(value);
+        } else if (strcmp(arg, "--ops-per-tx") == 0) {
+            config.ops_per_tx = atoi(value);
+        } else if (strcmp(arg, "--zipf") == 0) {
+            config.zipf_theta = atof(value);
+        } else if (strcmp(arg, "--chain-length") == 0) {
+            config.chain_length = atoi(value);
+        } else if (strcmp(arg, "--vacuum-ms") == 0) {
+            config.vacuum_ms = atoi(value);
+        } else if (strcmp(arg, "--idle-timeout-ms") == 0) {
+            config.idle_timeout_ms = atoi(value);
+        } else if (strcmp(arg, "--payload-bytes") == 0) {
+            config.payload_bytes = atoi(value);
+        } else if (strcmp(arg, "--warehouses") == 0) {
+            config.warehouses = atoi(value);
+        } else if (strcmp(arg, "--seed") == 0) {
+            config.seed = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--metrics-file") == 0) {
+            config.metrics_file = value;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+
+    // Sanity checks
+    int min_keys = config.workload == WORKLOAD_TPCC_LITE
+        ? config.warehouses * 11 + 1 : 1;
+    int slots_per_thread = config.chain_length > 1 ? 2 : 1;  // + chain reader
+    if (config.threads < 1 ||
+        config.threads * slots_per_thread >= MAX_TRANSACTIONS - 1 ||
+        config.shards < 1 || config.shards > MAX_TX_SHARDS ||
+        config.keys < min_keys || config.keys > MAX_TUPLES ||
+        config.read_pct < 0 || config.read_pct > 100 ||
+        config.ops_per_tx < 1 || config.chain_length < 1 ||
+        config.duration_ms < 1 || config.vacuum_ms < 0 ||
+        config.idle_timeout_ms < 0 || config.warehouses < 1 ||
+        config.payload_bytes < 0 || config.zipf_theta < 0.0 ||
+        config.zipf_theta >= 1.0) {
+        fprintf(stderr, "Invalid configuration (see --help)\n");
+        return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// JSON OUTPUT
+// ----------------------------------------------------------------------------
+// Percentiles are bucket tops ("le" = at most), so within a factor of two
+void print_latency_json(const char* name, const Latencies* l, bool last) {
+    uint64_t count = l->histogram.count;
+    printf("      \"%s\": {\"count\": %lu, \"mean\": %lu, \"p50_le\": %lu, "
+           "\"p99_le\": %lu, \"p999_le\": %lu, \"max\": %lu}%s\n",
+           name, count, count ? l->histogram.sum / count : 0,
+           latency_percentile_le(l, 0.50), latency_percentile_le(l, 0.99),
+           latency_percentile_le(l, 0.999), l->max, last ? "" : ",");
+}
+
+// Versions skipped per lookup: how many lookups fell in each bucket
+// ("le": at most that many hops), so --chain-length can be checked
+void print_hops_json(const HistogramSnapshot* hops) {
+    printf("      \"chain_hops_mean\": %.2f,\n",
+           hops->count ? (double)hops->sum / (double)hops->count : 0.0);
+    printf("      \"chain_hops_le\": {");
+    const char* separator = "";
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        if (hops->buckets[b]) {
+            printf("%s\"%lu\": %lu", separator, histogram_bucket_limit(b),
+                   hops->buckets[b]);
+            separator = ", ";
+        }
+    }
+    printf("},\n");
+}
+
+// ----------------------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if (!parse_args(argc, argv)) {
+        return 1;
+    }
+
+    init_transaction_manager();
+    init_table();
+    set_tx_shard_count(config.shards);
+    set_mvcc_mode(config.mode);
+
+    // tpcc-lite picks customers from the rows after the districts
+    int key_space = config.workload == WORKLOAD_TPCC_LITE
+        ? config.keys - config.warehouses * 11 : config.keys;
+    init_zipf(&key_dist, key_space, config.zipf_theta);
+
+    WorkerState* workers = (WorkerState*)calloc((size_t)config.threads,
+                                                sizeof(WorkerState));
+    thrd_t* threads = (thrd_t*)calloc((size_t)config.threads, sizeof(thrd_t));
+    thrd_t vacuum_thread;
+    atomic_store(&stop_flag, false);
+
+    if (!workers || !threads) {
+        fprintf(stderr, "Out of memory\n");
+        free(workers);
+        free(threads);
+        return 1;
+    }
+
+    if (!load_table(workers)) {
+        fprintf(stderr, "Could not load the table\n");
+        end_chain_readers(workers);
+        free(workers);
+        free(threads);
+        return 1;
+    }
+
+    // The long reader sees the table as loaded, so vacuum can't cut any
+    // version written during the run
+    Transaction* long_reader = NULL;
+    if (config.long_reader) {
+        long_reader = begin_read_only_transaction();
+    }
+
+    // Start the workers (and the vacuum)
+
+    uint64_t start = now_ns();
+    int started = 0;
+    bool vacuum_started = false;
+    bool failed = false;
+    for (int i = 0; i < config.threads && !failed; i++) {
+        workers[i].id = i;
+        workers[i].seed = config.seed * 0x9E3779B97F4A7C15ull + (uint64_t)i + 1;
+        failed = thrd_create(&threads[i], worker_main, &workers[i]) != thrd_success;
+        started += !failed;
+    }
+    if (!failed && config.vacuum_ms > 0) {
+        failed = thrd_create(&vacuum_thread, vacuum_main, NULL) != thrd_success;
+        vacuum_started = !failed;
+    }
+    if (failed) {
+        // Stop the ones that did start, and give up
+        atomic_store(&stop_flag, true);
+        for (int i = 0; i < started; i++) {
+            thrd_join(threads[i], NULL);
+        }
+        fprintf(stderr, "Could not start %d threads\n",
+                config.threads + (config.vacuum_ms > 0));
+        end_chain_readers(workers);
+        free(workers);
+        free(threads);
+        return 1;
+    }
+
+    struct timespec run_time = {
+        .tv_sec = config.duration_ms / 1000,
+        .tv_nsec = (long)(config.duration_ms % 1000) * 1000000L,
+    };
+    thrd_sleep(&run_time, NULL);
+    atomic_store(&stop_flag, true);
+
+    for (int i = 0; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
+    if (vacuum_started) {
+        thrd_join(vacuum_thread, NULL);
+    }
+    double seconds = (double)(now_ns() - start) / 1e9;
+
+    // Gather the results
+    ChainStats chains;
+    measure_chain_stats(&chains);
+    bool long_reader_terminated = long_reader && !commit_transaction(long_reader);
+    end_chain_readers(workers);
+
+    uint64_t committed = 0;
+    uint64_t aborted = 0;
+    uint64_t ops = 0;
+    Latencies reads = {0};
+    Latencies updates = {0};
+    Latencies all = {0};
+    for (int i = 0; i < config.threads; i++) {
+        committed += workers[i].committed;
+        aborted += workers[i].aborted;
+        ops += workers[i].ops;
+        merge_latencies(&reads, &workers[i].read_latency);
+        merge_latencies(&updates, &workers[i].update_latency);
+        merge_latencies(&all, &workers[i].read_latency);
+        merge_latencies(&all, &workers[i].update_latency);
+    }
+
+    EpochStats epoch_stats;
+    get_epoch_stats(&epoch_stats);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    MetricsSnapshot metrics;
+    get_metrics_snapshot(&metrics);
+
+    printf("{\n");
+    printf("  \"config\": {\n");
+    printf("    \"workload\": \"%s\",\n",
+           config.workload == WORKLOAD_YCSB ? "ycsb" : "tpcc-lite");
+    printf("    \"mode\": \"%s\",\n", config.mode == MVCC_MODE_XID ? "xid" : "ts");
+    printf("    \"threads\": %d,\n", config.threads);
+    printf("    \"shards\": %d,\n", config.shards);
+    printf("    \"duration_ms\": %d,\n", config.duration_ms);
+    printf("    \"keys\": %d,\n", config.keys);
+    printf("    \"read_pct\": %d,\n", config.read_pct);
+    printf("    \"ops_per_tx\": %d,\n", config.ops_per_tx);
+    printf("    \"zipf_theta\": %.3f,\n", config.zipf_theta);
+    printf("    \"chain_length\": %d,\n", config.chain_length);
+    printf("    \"long_reader\": %s,\n", config.long_reader ? "true" : "false");
+    printf("    \"read_only_begin\": %s,\n", config.read_only_begin ? "true" : "false");
+    printf("    \"vacuum_ms\": %d,\n", config.vacuum_ms);
+    printf("    \"idle_timeout_ms\": %d,\n", config.idle_timeout_ms);
+    printf("    \"payload_bytes\": %d,\n", config.payload_bytes);
+    printf("    \"seed\": %lu\n", config.seed);
+    printf("  },\n");
+    printf("  \"results\": {\n");
+    printf("    \"seconds\": %.3f,\n", seconds);
+    printf("    \"committed\": %lu,\n", committed);
+    printf("    \"aborted\": %lu,\n", aborted);
+    printf("    \"throughput_tps\": %.1f,\n", (double)committed / seconds);
+    printf("    \"ops_per_sec\": %.1f,\n", (double)ops / seconds);
+    printf("    \"latency_ns\": {\n");
+    print_latency_json("all", &all, false);
+    print_latency_json("read", &reads, false);
+    print_latency_json("update", &updates, true);
+    printf("    },\n");
+    printf("    \"memory\": {\n");
+    printf("      \"max_rss_kb\": %ld,\n", usage.ru_maxrss);
+    printf("      \"versions\": %lu,\n", chains.versions);
+    printf("      \"version_bytes\": %lu,\n", chains.bytes);
+    printf("      \"toast_values\": %lu,\n", toast_stats.values);
+    printf("      \"toast_bytes\": %lu,\n", toast_stats.bytes);
+    printf("      \"longest_chain\": %d,\n", chains.longest);
+    printf("      \"chain_length_p99_le\": %d,\n",
+           chain_length_percentile_le(&chains, 0.99));
+    printf("      \"limbo_items\": %lu,\n", epoch_stats.limbo_items);
+    printf("      \"limbo_bytes\": %lu\n", epoch_stats.limbo_bytes);
+    printf("    },\n");
+    printf("    \"vacuum\": {\n");
+    printf("      \"passes\": %lu,\n", vacuum_passes);
+    printf("      \"removed\": %lu,\n", vacuum_removed);
+    printf("      \"snapshots_terminated\": %lu,\n", snapshots_terminated);
+    printf("      \"long_reader_terminated\": %s,\n",
+           long_reader_terminated ? "true" : "false");
+    printf("      \"avg_reclaim_latency_ns\": %lu,\n", epoch_stats.avg_latency_ns);
+    printf("      \"max_reclaim_latency_ns\": %lu\n", epoch_stats.max_latency_ns);
+    printf("    },\n");
+    printf("    \"engine\": {\n");
+    printf("      \"lookups\": %lu,\n", metrics.counters[METRIC_LOOKUPS]);
+    printf("      \"visibility_checks\": %lu,\n",
+           metrics.counters[METRIC_VISIBILITY_CHECKS]);
+    printf("      \"write_conflicts\": %lu,\n",
+           metrics.counters[METRIC_WRITE_CONFLICTS]);
+    printf("      \"begin_snapshot_reused\": %lu,\n",
+           metrics.counters[METRIC_SNAPSHOT_REUSED]);
+    print_hops_json(&metrics.histograms[HIST_CHAIN_HOPS]);
+    printf("      \"chain_hops_p50_le\": %lu,\n",
+           histogram_percentile(&metrics.histograms[HIST_CHAIN_HOPS], 0.50));
+    printf("      \"chain_hops_p99_le\": %lu,\n",
+           histogram_percentile(&metrics.histograms[HIST_CHAIN_HOPS], 0.99));
+    printf("      \"commit_p99_ns_bucket\": %lu,\n",
+           histogram_percentile(&metrics.histograms[HIST_COMMIT_NS], 0.99));
+    printf("      \"vacuum_pass_p99_ns_bucket\": %lu\n",
+           histogram_percentile(&metrics.histograms[HIST_VACUUM_NS], 0.99));
+    printf("    }\n");
+    printf("  }\n");
+    printf("}\n");
+
+    free(workers);
+    free(threads);
+
+    if (config.metrics_file && !dump_metrics_to_file(config.metrics_file)) {
+        fprintf(stderr, "Could not write %s\n", config.metrics_file);
+        return 1;
+    }
+    return 0;
+}
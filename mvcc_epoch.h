@@ -0,0 +1,321 @@
+/*----------------------------------------------------------------------------
+ * This makes it safe to FREE old versions while other threads might still
+ * be walking over them. It's like a library that never throws a book away
+ * while somebody could still be reading it.
+ *
+ * How it works (epoch-based reclamation):
+ * - There is a global "epoch" number, like the date on a calendar.
+ * - A reader writes down today's date on its card when it starts walking
+ *   a version chain, and wipes the card when it's done. No locks!
+ * - When vacuum unlinks old versions, it doesn't free them. It puts them
+ *   in a "limbo" bag labeled with today's date, and turns the calendar.
+ * - A bag is only freed when every reader that is still reading started
+ *   AFTER the bag's date - so nobody can possibly still be holding it.
+ * ---------------------------------------------------------------------------
+ */
+
+#ifndef MVCC_EPOCH_H
+#define MVCC_EPOCH_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+// How many threads can have their own reader card
+#define MAX_EPOCH_THREADS 256
+
+// A blank reader card (the real epochs start at 1)
+#define EPOCH_INACTIVE 0
+
+// ----------------------------------------------------------------------------
+// READER CARD
+// ----------------------------------------------------------------------------
+// One per thread, each on its own cache line so readers never fight over
+// the same memory.
+typedef struct {
+    _Alignas(64) _Atomic uint64_t epoch;  // Date we started reading (or 0)
+    _Atomic bool in_use;                  // Does a thread own this card?
+} EpochSlot;
+
+// ----------------------------------------------------------------------------
+// LIMBO
+// ----------------------------------------------------------------------------
+// Things that are unlinked but maybe still being read
+typedef struct {
+    void* ptr;
+    size_t bytes;
+    void (*free_fn)(void*);
+} LimboItem;
+
+typedef struct LimboBag {
+    uint64_t epoch;            // The date on the bag (set when sealed)
+    uint64_t first_retire_ns;  // When the first item went in
+    LimboItem* items;
+    int count;
+    int capacity;
+    struct LimboBag* next;     // Next (newer) sealed bag
+} LimboBag;
+
+// ----------------------------------------------------------------------------
+// RECLAMATION STATS
+// ----------------------------------------------------------------------------
+typedef struct {
+    uint64_t global_epoch;
+    uint64_t retired;             // Items ever put in limbo
+    uint64_t freed;               // Items ever freed
+    uint64_t limbo_items;         // Items waiting in limbo right now
+    uint64_t limbo_bytes;         // Memory waiting in limbo right now
+    uint64_t avg_latency_ns;      // Average time from retire to free
+    uint64_t max_latency_ns;      // Longest time from retire to free
+} EpochStats;
+
+// ----------------------------------------------------------------------------
+// EPOCH MANAGER
+// ----------------------------------------------------------------------------
+typedef struct {
+    _Atomic uint64_t global_epoch;
+    EpochSlot slots[MAX_EPOCH_THREADS];
+
+    // Readers that couldn't get a card. While any of them is reading,
+    // nothing gets freed (slow, but always safe).
+    _Atomic int anonymous_readers;
+
+    // Limbo is only touched by retire/collect, never by readers
+    mtx_t limbo_lock;
+    LimboBag* open_bag;      // Filling up right now
+    LimboBag* sealed_head;   // Oldest sealed bag
+    LimboBag* sealed_tail;   // Newest sealed bag
+
+    uint64_t retired;
+    uint64_t freed;
+    uint64_t limbo_items;
+    uint64_t limbo_bytes;
+    uint64_t total_latency_ns;
+    uint64_t max_latency_ns;
+} EpochManager;
+
+// Global epoch manager (only one exists)
+EpochManager epoch_manager;
+
+// This thread's reader card (-1 = none yet, -2 = no card available)
+_Thread_local int epoch_slot = -1;
+_Thread_local int epoch_depth = 0;
+
+// ----------------------------------------------------------------------------
+// INITIALIZE
+// ----------------------------------------------------------------------------
+void init_epoch_manager() {
+    atomic_store(&epoch_manager.global_epoch, 1);
+    for (int i = 0; i < MAX_EPOCH_THREADS; i++) {
+        atomic_store(&epoch_manager.slots[i].epoch, EPOCH_INACTIVE);
+        atomic_store(&epoch_manager.slots[i].in_use, false);
+    }
+    atomic_store(&epoch_manager.anonymous_readers, 0);
+    mtx_init(&epoch_manager.limbo_lock, mtx_plain);
+    epoch_manager.open_bag = NULL;
+    epoch_manager.sealed_head = NULL;
+    epoch_manager.sealed_tail = NULL;
+    epoch_manager.retired = 0;
+    epoch_manager.freed = 0;
+    epoch_manager.limbo_items = 0;
+    epoch_manager.limbo_bytes = 0;
+    epoch_manager.total_latency_ns = 0;
+    epoch_manager.max_latency_ns = 0;
+    epoch_slot = -1;
+    epoch_depth = 0;
+}
+
+uint64_t epoch_now_ns() {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// ----------------------------------------------------------------------------
+// GET A READER CARD FOR THIS THREAD
+// ----------------------------------------------------------------------------
+void epoch_register_thread() {
+    for (int i = 0; i < MAX_EPOCH_THREADS; i++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&epoch_manager.slots[i].in_use,
+                                           &expected, true)) {
+            epoch_slot = i;
+            return;
+        }
+    }
+    epoch_slot = -2;  // All cards taken: read "anonymously"
+}
+
+// Give the card back (call before a thread exits)
+void epoch_unregister_thread() {
+    if (epoch_slot >= 0) {
+        atomic_store(&epoch_manager.slots[epoch_slot].epoch, EPOCH_INACTIVE);
+        atomic_store(&epoch_manager.slots[epoch_slot].in_use, false);
+    }
+    epoch_slot = -1;
+    epoch_depth = 0;
+}
+
+// ----------------------------------------------------------------------------
+// ENTER / EXIT A READ SECTION
+// ----------------------------------------------------------------------------
+// Anything you got from a version chain is only safe to use between
+// epoch_enter() and epoch_exit(). Calls can be nested.
+void epoch_enter() {
+    if (epoch_depth++ > 0) {
+        return;  // Already inside
+    }
+    if (epoch_slot == -1) {
+        epoch_register_thread();
+    }
+    if (epoch_slot >= 0) {
+        // Write today's date on our card BEFORE touching any chain
+        atomic_store(&epoch_manager.slots[epoch_slot].epoch,
+                     atomic_load(&epoch_manager.global_epoch));
+    } else {
+        atomic_fetch_add(&epoch_manager.anonymous_readers, 1);
+    }
+}
+
+void epoch_exit() {
+    if (--epoch_depth > 0) {
+        return;
+    }
+    if (epoch_slot >= 0) {
+        atomic_store_explicit(&epoch_manager.slots[epoch_slot].epoch,
+                              EPOCH_INACTIVE, memory_order_release);
+    } else {
+        atomic_fetch_sub(&epoch_manager.anonymous_readers, 1);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// RETIRE
+// ----------------------------------------------------------------------------
+// Hand over something that is already unlinked (no NEW reader can reach
+// it). It is freed with free_fn once every old reader is gone.
+bool epoch_retire(void* ptr, size_t bytes, void (*free_fn)(void*)) {
+    mtx_lock(&epoch_manager.limbo_lock);
+
+    LimboBag* bag = epoch_manager.open_bag;
+    if (!bag) {
+        bag = (LimboBag*)calloc(1, sizeof(LimboBag));
+        if (!bag) {
+            mtx_unlock(&epoch_manager.limbo_lock);
+            return false;
+        }
+        bag->first_retire_ns = epoch_now_ns();
+        epoch_manager.open_bag = bag;
+    }
+    if (bag->count == bag->capacity) {
+        int new_capacity = bag->capacity ? bag->capacity * 2 : 64;
+        LimboItem* grown = (LimboItem*)realloc(
+            bag->items, (size_t)new_capacity * sizeof(LimboItem));
+        if (!grown) {
+            mtx_unlock(&epoch_manager.limbo_lock);
+            return false;
+        }
+        bag->items = grown;
+        bag->capacity = new_capacity;
+    }
+
+    bag->items[bag->count].ptr = ptr;
+    bag->items[bag->count].bytes = bytes;
+    bag->items[bag->count].free_fn = free_fn;
+    bag->count++;
+
+    epoch_manager.retired++;
+    epoch_manager.limbo_items++;
+    epoch_manager.limbo_bytes += bytes;
+
+    mtx_unlock(&epoch_manager.limbo_lock);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// COLLECT
+// ----------------------------------------------------------------------------
+// Seal the open bag, turn the calendar, and free every bag that all
+// current readers have moved past. Returns how many items were freed.
+int epoch_collect() {
+    mtx_lock(&epoch_manager.limbo_lock);
+
+    // Seal the open bag with today's date and turn the calendar
+    LimboBag* bag = epoch_manager.open_bag;
+    if (bag) {
+        bag->epoch = atomic_load(&epoch_manager.global_epoch);
+        bag->next = NULL;
+        if (epoch_manager.sealed_tail) {
+            epoch_manager.sealed_tail->next = bag;
+        } else {
+            epoch_manager.sealed_head = bag;
+        }
+        epoch_manager.sealed_tail = bag;
+        epoch_manager.open_bag = NULL;
+    }
+    atomic_fetch_add(&epoch_manager.global_epoch, 1);
+
+    // Find the oldest date on any reader's card
+    uint64_t oldest = UINT64_MAX;
+    if (atomic_load(&epoch_manager.anonymous_readers) > 0) {
+        oldest = 0;  // Someone without a card is reading: free nothing
+    }
+    for (int i = 0; i < MAX_EPOCH_THREADS && oldest > 0; i++) {
+        uint64_t e = atomic_load(&epoch_manager.slots[i].epoch);
+        if (e != EPOCH_INACTIVE && e < oldest) {
+            oldest = e;
+        }
+    }
+
+    // Free every bag from before that date
+    int freed = 0;
+    uint64_t now = epoch_now_ns();
+    while (epoch_manager.sealed_head &&
+           epoch_manager.sealed_head->epoch < oldest) {
+        LimboBag* done = epoch_manager.sealed_head;
+        epoch_manager.sealed_head = done->next;
+        if (!epoch_manager.sealed_head) {
+            epoch_manager.sealed_tail = NULL;
+        }
+
+        uint64_t latency = now - done->first_retire_ns;
+        for (int i = 0; i < done->count; i++) {
+            done->items[i].free_fn(done->items[i].ptr);
+            epoch_manager.limbo_bytes -= done->items[i].bytes;
+        }
+        epoch_manager.limbo_items -= (uint64_t)done->count;
+        epoch_manager.freed += (uint64_t)done->count;
+        epoch_manager.total_latency_ns += latency * (uint64_t)done->count;
+        if (latency > epoch_manager.max_latency_ns) {
+            epoch_manager.max_latency_ns = latency;
+        }
+        freed += done->count;
+
+        free(done->items);
+        free(done);
+    }
+
+    mtx_unlock(&epoch_manager.limbo_lock);
+    return freed;
+}
+
+// ----------------------------------------------------------------------------
+// REPORT
+// ----------------------------------------------------------------------------
+void get_epoch_stats(EpochStats* stats) {
+    mtx_lock(&epoch_manager.limbo_lock);
+    stats->global_epoch = atomic_load(&epoch_manager.global_epoch);
+    stats->retired = epoch_manager.retired;
+    stats->freed = epoch_manager.freed;
+    stats->limbo_items = epoch_manager.limbo_items;
+    stats->limbo_bytes = epoch_manager.limbo_bytes;
+    stats->avg_latency_ns = epoch_manager.freed
+        ? epoch_manager.total_latency_ns / epoch_manager.freed : 0;
+    stats->max_latency_ns = epoch_manager.max_latency_ns;
+    mtx_unlock(&epoch_manager.limbo_lock);
+}
+
+#endif
@@ -60,9 +60,44 @@ void print_system_status() {
     printf("╔════════════════════════════════════════════════════════════════╗\n");
     printf("║                    SYSTEM STATUS                               ║\n");
     printf("╚════════════════════════════════════════════════════════════════╝\n");
-    printf("Next Transaction ID: %lu\n", tx_manager.next_xid);
-    printf("Active Transactions: %d\n", tx_manager.active_count);
+    printf("XIDs Handed Out: %lu (%d shard%s)\n", count_assigned_xids(),
+           tx_manager.shard_count, tx_manager.shard_count == 1 ? "" : "s");
+    printf("Active Transactions: %d\n", count_active_transactions());
+    printf("Commits That Wrote Something: %lu\n", count_commits());
     printf("Tuples in Table: %d\n", global_table.tuple_count);
+
+    EpochStats epoch_stats;
+    get_epoch_stats(&epoch_stats);
+    printf("Versions in Limbo: %lu (%lu bytes, %lu freed so far)\n",
+           epoch_stats.limbo_items, epoch_stats.limbo_bytes,
+           epoch_stats.freed);
+
+    MetricsSnapshot metrics;
+    get_metrics_snapshot(&metrics);
+    HistogramSnapshot* hops = &metrics.histograms[HIST_CHAIN_HOPS];
+    printf("Version Lookups: %lu (%lu versions checked, p99 <= %lu hops)\n",
+           metrics.counters[METRIC_LOOKUPS],
+           metrics.counters[METRIC_VISIBILITY_CHECKS],
+           histogram_percentile(hops, 0.99));
+    printf("Write Conflicts: %lu\n", metrics.counters[METRIC_WRITE_CONFLICTS]);
+    printf("Out-of-line Values: %lu (%lu bytes, shared %lu times)\n",
+           toast_stats.values, toast_stats.bytes,
+           metrics.counters[METRIC_TOAST_SHARED]);
+    printf("Row Versions: %lu deltas, %lu full\n",
+           metrics.counters[METRIC_DELTA_VERSIONS],
+           metrics.counters[METRIC_FULL_VERSIONS]);
+
+    ChainStats chains;
+    measure_chain_stats(&chains);
+    printf("Longest Version Chain: %d (row %d, p99 <= %d)\n",
+           chains.longest, chains.longest_row,
+           chain_length_percentile_le(&chains, 0.99));
+
+    CleanupBlocker oldest;
+    if (get_cleanup_blockers(&oldest, 1) > 0) {
+        printf("Oldest Snapshot: read_ts %lu, idle %lu us\n",
+               oldest.read_ts, oldest.idle_ns / 1000);
+    }
     printf("\n");
 }
 
@@ -113,6 +148,46 @@ int main() {
     test_concurrent();
     print_system_status();
 
+    printf("\nPress ENTER for Test 6 (Abort Cleanup)...\n");
+    getchar();
+    test_abort_cleanup();
+    print_system_status();
+
+    printf("\nPress ENTER for Test 7 (Savepoints)...\n");
+    getchar();
+    test_savepoints();
+    print_system_status();
+
+    printf("\nPress ENTER for Test 8 (Read-Only Transactions)...\n");
+    getchar();
+    test_read_only();
+    print_system_status();
+
+    printf("\nPress ENTER for Test 9 (Timestamp Mode)...\n");
+    getchar();
+    test_timestamp_mode();
+    print_system_status();
+
+    printf("\nPress ENTER for Test 10 (Long Snapshots)...\n");
+    getchar();
+    test_long_snapshots();
+    print_system_status();
+
+    printf("\nPress ENTER for Test 11 (Rows with Columns)...\n");
+    getchar();
+    test_wide_rows();
+    print_system_status();
+
+    printf("\nPress ENTER for Test 12 (Updates Store Only What Changed)...\n");
+    getchar();
+    test_delta_versions();
+    print_system_status();
+
+    printf("\nPress ENTER for Test 13 (Sharded Transaction Manager)...\n");
+    getchar();
+    test_sharded_manager();
+    print_system_status();
+
     // Step 4: Summary
     printf("\n");
     printf("╔════════════════════════════════════════════════════════════════╗\n");
@@ -133,11 +208,14 @@ int main() {
     printf("  2. mvcc_transaction_manager.h - Transaction lifecycle\n");
     printf("  3. mvcc_visibility.h          - Visibility rules (MVCC core!)\n");
     printf("  4. mvcc_table.h               - Storage & operations\n");
-    printf("  5. mvcc_tests.h               - Test scenarios\n");
-    printf("  6. mvcc_main.c                - This main program\n");
+    printf("  5. mvcc_epoch.h               - Safe freeing of old versions\n");
+    printf("  6. mvcc_metrics.h             - Counters and latency histograms\n");
+    printf("  7. mvcc_row.h                 - Rows, long values, deltas\n");
+    printf("  8. mvcc_tests.h               - Test scenarios\n");
+    printf("  9. mvcc_main.c                - This main program\n");
     printf("\n");
     printf("To compile:\n");
-    printf("  gcc -std=c11 -o mvcc_demo mvcc_main.c\n");  // To compile this whole MVCC
+    printf("  gcc -std=c11 -pthread -o mvcc_demo mvcc_main.c\n");  // To compile this whole MVCC
     printf("\n");
 
     return 0;
@@ -168,6 +246,9 @@ mvcc_types.h               : Core data structures
 mvcc_transaction_manager.h : Transaction control
 mvcc_visibility.h          : Visibility rules (THE MAGIC!)
 mvcc_table.h               : Storage and SQL operations
+mvcc_epoch.h               : Epoch-based reclamation (safe concurrent vacuum)
+mvcc_metrics.h             : Per-thread counters, histograms, Prometheus dump
+mvcc_row.h                 : Schema rows, TOAST values, delta versions
 mvcc_tests.h               : Comprehensive test suite
 mvcc_main.c                : Entry point and integration
 
@@ -0,0 +1,455 @@
+/*----------------------------------------------------------------------------
+ * This counts what the engine is doing - like the counters at a stadium
+ * gate that click every time somebody walks through.
+ *
+ * How it works:
+ * - Every thread gets its OWN set of counters (a "shard"), on its own
+ *   cache lines. Clicking your own counter needs no lock and no fight
+ *   with other threads, so it costs about as much as "x = x + 1".
+ * - Whoever wants the totals adds up all the shards (merged on read).
+ * - Timings go into histograms with power-of-two buckets: bucket i holds
+ *   values from 2^(i-1) up to 2^i - 1. Good enough to find p50/p99.
+ * - The totals can be written out in Prometheus text format, to a file
+ *   or to any open file descriptor (a pipe or a socket, for example).
+ * ---------------------------------------------------------------------------
+ */
+
+#ifndef MVCC_METRICS_H
+#define MVCC_METRICS_H
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// How many threads can have their own shard (the rest share one)
+#define MAX_METRICS_THREADS 256
+
+// Reading the clock costs more than a visibility lookup, so only about
+// one begin, commit or lookup in this many is timed
+#define METRICS_SAMPLE_EVERY 64
+
+// Bucket 0 is for the value 0, bucket i for values below 2^i
+#define HISTOGRAM_BUCKETS 65
+
+// ----------------------------------------------------------------------------
+// WHAT WE COUNT
+// ----------------------------------------------------------------------------
+typedef enum {
+    METRIC_TX_BEGIN,             // Transactions started (all kinds)
+    METRIC_TX_BEGIN_READ_ONLY,   // ...of which read-only
+    METRIC_SNAPSHOT_REUSED,      // Begins (any kind) that shared the cached
+                                 // snapshot instead of building one
+    METRIC_TX_COMMIT,
+    METRIC_TX_ABORT,
+    METRIC_SAVEPOINT_ROLLBACK,
+    METRIC_LOOKUPS,              // Chain walks looking for a visible version
+    METRIC_VISIBILITY_CHECKS,    // Versions checked during those walks
+    METRIC_WRITE_CONFLICTS,      // Lost the race to claim a version
+    METRIC_VERSIONS_CREATED,
+    METRIC_VACUUM_PASSES,
+    METRIC_VERSIONS_REMOVED,     // Cut off by vacuum
+    METRIC_SNAPSHOTS_TERMINATED, // Idle old transactions aborted
+    METRIC_TOAST_CREATED,        // Long values stored out of line
+    METRIC_TOAST_SHARED,         // ...and reused by a new version instead
+    METRIC_DELTA_VERSIONS,       // Row versions storing only changed columns
+    METRIC_FULL_VERSIONS,        // Row versions storing every column
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+typedef enum {
+    HIST_BEGIN_NS,               // Time to begin a transaction (sampled)
+    HIST_COMMIT_NS,              // Time to commit (sampled)
+    HIST_VISIBILITY_NS,          // Time for one lookup (sampled)
+    HIST_CHAIN_HOPS,             // Versions skipped per lookup
+    HIST_VACUUM_NS,              // Time for one vacuum pass
+    HIST_COUNT
+} MetricHistogram;
+
+// Names used in the Prometheus dump
+const char* metric_counter_names[METRIC_COUNTER_COUNT] = {
+    "mvcc_tx_begin_total",
+    "mvcc_tx_begin_read_only_total",
+    "mvcc_tx_begin_snapshot_reused_total",
+    "mvcc_tx_commit_total",
+    "mvcc_tx_abort_total",
+    "mvcc_savepoint_rollback_total",
+    "mvcc_lookups_total",
+    "mvcc_visibility_checks_total",
+    "mvcc_write_conflicts_total",
+    "mvcc_versions_created_total",
+    "mvcc_vacuum_passes_total",
+    "mvcc_versions_removed_total",
+    "mvcc_snapshots_terminated_total",
+    "mvcc_toast_created_total",
+    "mvcc_toast_shared_total",
+    "mvcc_delta_versions_total",
+    "mvcc_full_versions_total",
+};
+
+const char* metric_histogram_names[HIST_COUNT] = {
+    "mvcc_begin_latency_ns",
+    "mvcc_commit_latency_ns",
+    "mvcc_visibility_latency_ns",
+    "mvcc_chain_hops",
+    "mvcc_vacuum_pass_latency_ns",
+};
+
+// ----------------------------------------------------------------------------
+// ONE THREAD'S COUNTERS
+// ----------------------------------------------------------------------------
+typedef struct {
+    _Atomic uint64_t buckets[HISTOGRAM_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+} Histogram;
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t counters[METRIC_COUNTER_COUNT];
+    Histogram histograms[HIST_COUNT];
+    _Atomic bool in_use;
+} MetricsShard;
+
+// ----------------------------------------------------------------------------
+// SNAPSHOT (the merged totals)
+// ----------------------------------------------------------------------------
+typedef struct {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+} HistogramSnapshot;
+
+typedef struct {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    HistogramSnapshot histograms[HIST_COUNT];
+} MetricsSnapshot;
+
+// ----------------------------------------------------------------------------
+// METRICS REGISTRY
+// ----------------------------------------------------------------------------
+// The last shard is shared by threads that couldn't get their own
+typedef struct {
+    MetricsShard shards[MAX_METRICS_THREADS + 1];
+} MetricsRegistry;
+
+// Global registry (only one exists)
+MetricsRegistry metrics_registry;
+
+// This thread's shard (-1 = none yet)
+_Thread_local int metrics_shard = -1;
+// Calls left until the next timed one, per histogram
+_Thread_local uint32_t metrics_sample_countdown[HIST_COUNT];
+_Thread_local uint64_t metrics_sample_seed = 0;
+
+// ----------------------------------------------------------------------------
+// INITIALIZE
+// ----------------------------------------------------------------------------
+void init_metrics() {
+    for (int s = 0; s <= MAX_METRICS_THREADS; s++) {
+        MetricsShard* shard = &metrics_registry.shards[s];
+        for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+            atomic_store(&shard->counters[c], 0);
+        }
+        for (int h = 0; h < HIST_COUNT; h++) {
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+                atomic_store(&shard->histograms[h].buckets[b], 0);
+            }
+            atomic_store(&shard->histograms[h].count, 0);
+            atomic_store(&shard->histograms[h].sum, 0);
+        }
+        atomic_store(&shard->in_use, false);
+    }
+    metrics_shard = -1;
+}
+
+uint64_t metrics_now_ns() {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// ----------------------------------------------------------------------------
+// GET A SHARD FOR THIS THREAD
+// ----------------------------------------------------------------------------
+void metrics_register_thread() {
+    for (int i = 0; i < MAX_METRICS_THREADS; i++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&metrics_registry.shards[i].in_use,
+                                           &expected, true)) {
+            metrics_shard = i;
+            return;
+        }
+    }
+    metrics_shard = MAX_METRICS_THREADS;  // Use the shared one
+}
+
+// Give the shard back (call before a thread exits). Its counts stay in
+// the totals; the next thread to take it just keeps adding.
+void metrics_unregister_thread() {
+    if (metrics_shard >= 0 && metrics_shard < MAX_METRICS_THREADS) {
+        atomic_store(&metrics_registry.shards[metrics_shard].in_use, false);
+    }
+    metrics_shard = -1;
+}
+
+// ----------------------------------------------------------------------------
+// CLICK A COUNTER
+// ----------------------------------------------------------------------------
+// Only the owner writes to its own shard, so a plain load + store is
+// enough (no locked instruction). The shared shard needs a real add.
+void metrics_bump(_Atomic uint64_t* counter, uint64_t amount) {
+    if (metrics_shard < MAX_METRICS_THREADS) {
+        atomic_store_explicit(counter,
+                              atomic_load_explicit(counter, memory_order_relaxed) + amount,
+                              memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(counter, amount, memory_order_relaxed);
+    }
+}
+
+MetricsShard* metrics_my_shard() {
+    if (metrics_shard < 0) {
+        metrics_register_thread();
+    }
+    return &metrics_registry.shards[metrics_shard];
+}
+
+void metrics_add(MetricCounter counter, uint64_t amount) {
+    metrics_bump(&metrics_my_shard()->counters[counter], amount);
+}
+
+void metrics_inc(MetricCounter counter) {
+    metrics_add(counter, 1);
+}
+
+// ----------------------------------------------------------------------------
+// RECORD A VALUE IN A HISTOGRAM
+// ----------------------------------------------------------------------------
+int histogram_bucket(uint64_t value) {
+#if defined(__GNUC__)
+    return value == 0 ? 0 : 64 - __builtin_clzll(value);
+#else
+    int bucket = 0;
+    while (value) {
+        bucket++;
+        value >>= 1;
+    }
+    return bucket;
+#endif
+}
+
+void metrics_observe(MetricHistogram histogram, uint64_t value) {
+    Histogram* h = &metrics_my_shard()->histograms[histogram];
+    metrics_bump(&h->buckets[histogram_bucket(value)], 1);
+    metrics_bump(&h->count, 1);
+    metrics_bump(&h->sum, value);
+}
+
+// Should this one be timed? Each histogram counts down on its own, so
+// lookups can't use up the turns meant for begins. The gap to the next
+// timed call is random (METRICS_SAMPLE_EVERY on average): a fixed gap
+// lines up with workloads that repeat, like "read-only, then read-write"
+// with 64 being even, and only ever times one of the two.
+bool metrics_should_sample(MetricHistogram histogram) {
+    uint32_t* left = &metrics_sample_countdown[histogram];
+    if (*left > 1) {
+        (*left)--;
+        return false;
+    }
+    // xorshift: cheap, and good enough to break up patterns
+    uint64_t x = metrics_sample_seed;
+    if (x == 0) {
+        x = (uint64_t)(uintptr_t)&metrics_sample_seed | 1;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    metrics_sample_seed = x;
+    *left = 1 + (uint32_t)(x % (2 * METRICS_SAMPLE_EVERY - 1));
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// READ THE TOTALS
+// ----------------------------------------------------------------------------
+// Adds up every shard. Threads keep counting while we read, so the
+// totals are each exact at some moment, just not all at the same moment.
+void get_metrics_snapshot(MetricsSnapshot* snap) {
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        snap->counters[c] = 0;
+    }
+    for (int h = 0; h < HIST_COUNT; h++) {
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            snap->histograms[h].buckets[b] = 0;
+        }
+        snap->histograms[h].count = 0;
+        snap->histograms[h].sum = 0;
+    }
+
+    for (int s = 0; s <= MAX_METRICS_THREADS; s++) {
+        MetricsShard* shard = &metrics_registry.shards[s];
+        for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+            snap->counters[c] += atomic_load_explicit(&shard->counters[c],
+                                                      memory_order_relaxed);
+        }
+        for (int h = 0; h < HIST_COUNT; h++) {
+            Histogram* from = &shard->histograms[h];
+            HistogramSnapshot* to = &snap->histograms[h];
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+                to->buckets[b] += atomic_load_explicit(&from->buckets[b],
+                                                       memory_order_relaxed);
+            }
+            to->count += atomic_load_explicit(&from->count, memory_order_relaxed);
+            to->sum += atomic_load_explicit(&from->sum, memory_order_relaxed);
+        }
+    }
+}
+
+// Largest value that fits in bucket b
+uint64_t histogram_bucket_limit(int bucket) {
+    if (bucket == 0) {
+        return 0;
+    }
+    return bucket >= 64 ? UINT64_MAX : (1ull << bucket) - 1;
+}
+
+// Upper limit of the bucket holding the p-th value (p from 0.0 to 1.0)
+uint64_t histogram_percentile(const HistogramSnapshot* h, double p) {
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * (double)(h->count - 1)) + 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            return histogram_bucket_limit(b);
+        }
+    }
+    return UINT64_MAX;
+}
+
+// ----------------------------------------------------------------------------
+// PROMETHEUS TEXT
+// ----------------------------------------------------------------------------
+typedef struct {
+    char* text;
+    size_t length;
+    size_t capacity;
+} MetricsText;
+
+bool metrics_text_append(MetricsText* out, const char* format, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int needed = vsnprintf(out->text + out->length,
+                               out->capacity - out->length, format, args);
+        va_end(args);
+        if (needed < 0) {
+            return false;
+        }
+        if ((size_t)needed < out->capacity - out->length) {
+            out->length += (size_t)needed;
+            return true;
+        }
+
+        // Didn't fit: grow and try again
+        size_t new_capacity = out->capacity ? out->capacity * 2 : 4096;
+        while (new_capacity - out->length <= (size_t)needed) {
+            new_capacity *= 2;
+        }
+        char* grown = (char*)realloc(out->text, new_capacity);
+        if (!grown) {
+            return false;
+        }
+        out->text = grown;
+        out->capacity = new_capacity;
+    }
+}
+
+// Build the whole dump in memory. The caller frees out->text.
+bool format_metrics_prometheus(MetricsText* out) {
+    MetricsSnapshot snap;
+    get_metrics_snapshot(&snap);
+    out->text = NULL;
+    out->length = 0;
+    out->capacity = 0;
+
+    bool ok = true;
+    for (int c = 0; c < METRIC_COUNTER_COUNT && ok; c++) {
+        ok = metrics_text_append(out, "# TYPE %s counter\n%s %lu\n",
+                                 metric_counter_names[c],
+                                 metric_counter_names[c], snap.counters[c]);
+    }
+
+    for (int h = 0; h < HIST_COUNT && ok; h++) {
+        const char* name = metric_histogram_names[h];
+        HistogramSnapshot* hist = &snap.histograms[h];
+
+        // Prometheus buckets are cumulative; stop after the last used one
+        int last = 0;
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            if (hist->buckets[b]) {
+                last = b;
+            }
+        }
+        ok = metrics_text_append(out, "# TYPE %s histogram\n", name);
+        uint64_t cumulative = 0;
+        for (int b = 0; b <= last && b < 64 && ok; b++) {
+            cumulative += hist->buckets[b];
+            ok = metrics_text_append(out, "%s_bucket{le=\"%lu\"} %lu\n",
+                                     name, histogram_bucket_limit(b), cumulative);
+        }
+        ok = ok && metrics_text_append(out, "%s_bucket{le=\"+Inf\"} %lu\n"
+                                            "%s_sum %lu\n%s_count %lu\n",
+                                       name, hist->count, name, hist->sum,
+                                       name, hist->count);
+    }
+
+    if (!ok) {
+        free(out->text);
+        out->text = NULL;
+    }
+    return ok;
+}
+
+// Write the dump to an open file descriptor (file, pipe or socket)
+bool dump_metrics_to_fd(int fd) {
+    MetricsText out;
+    if (!format_metrics_prometheus(&out)) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < out.length) {
+        ssize_t n = write(fd, out.text + written, out.length - written);
+        if (n <= 0) {
+            free(out.text);
+            return false;
+        }
+        written += (size_t)n;
+    }
+    free(out.text);
+    return true;
+}
+
+// Write the dump to a file (replacing it)
+bool dump_metrics_to_file(const char* path) {
+    MetricsText out;
+    if (!format_metrics_prometheus(&out)) {
+        return false;
+    }
+    FILE* file = fopen(path, "w");
+    bool ok = file != NULL;
+    if (ok) {
+        ok = fwrite(out.text, 1, out.length, file) == out.length;
+        ok = fclose(file) == 0 && ok;
+    }
+    free(out.text);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,403 @@
+/*----------------------------------------------------------------------------
+ * This lets a row have many columns instead of one number - like a form
+ * with boxes for a name, an age and a long story.
+ *
+ * How a row is stored (one block of memory per version):
+ * - Numbers are stored right in their column slot (fixed width).
+ * - Short text is stored inside the same block, after the slots.
+ * - Long text is stored OUT OF LINE ("TOAST", like PostgreSQL does) in
+ *   chunks of its own. The row only keeps a pointer to it. When an update
+ *   doesn't change that column, the new version points at the SAME chunks
+ *   (we just count one more owner), so a big story is never copied just
+ *   because somebody changed the age.
+ * - An update usually stores only the columns it changed (a "delta") plus
+ *   a bitmap saying which ones. To read a column we walk down the chain
+ *   until some version has it - at the latest the nearest FULL version.
+ *   Every DELTA_CHAIN_MAX updates we store a full version again, so a
+ *   reader never has to walk far.
+ * ---------------------------------------------------------------------------
+ */
+
+#ifndef MVCC_ROW_H
+#define MVCC_ROW_H
+
+#include "mvcc_types.h"
+#include "mvcc_metrics.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Most columns a row can have
+#define MAX_COLUMNS 32
+
+// Text longer than this is moved out of line
+#define TOAST_THRESHOLD 256
+
+// Out-of-line text is cut into chunks this big
+#define TOAST_CHUNK_SIZE 1024
+
+// At most this many deltas in a row, then a full version again
+#define DELTA_CHAIN_MAX 8
+
+// ----------------------------------------------------------------------------
+// SCHEMA
+// ----------------------------------------------------------------------------
+// The schema says what boxes the form has
+typedef enum {
+    COL_INT32,
+    COL_INT64,
+    COL_TEXT      // Any length (bytes, not NUL-terminated)
+} ColumnType;
+
+typedef struct {
+    const char* name;
+    ColumnType type;
+} Column;
+
+typedef struct {
+    int column_count;   // 0 = the classic single-int table
+    Column columns[MAX_COLUMNS];
+} Schema;
+
+// ----------------------------------------------------------------------------
+// VALUE
+// ----------------------------------------------------------------------------
+// One column's value, going in or coming out
+typedef struct {
+    ColumnType type;
+    int64_t number;      // COL_INT32 / COL_INT64
+    const char* text;    // COL_TEXT
+    uint32_t length;     // COL_TEXT: length in bytes
+} Value;
+
+// ----------------------------------------------------------------------------
+// OUT-OF-LINE (TOAST) VALUE
+// ----------------------------------------------------------------------------
+// Shared by every version that didn't change it. The last version to be
+// freed frees it.
+typedef struct {
+    _Atomic int refs;     // How many versions point here
+    uint32_t length;      // Total bytes
+    int chunk_count;
+    char* chunks[];       // TOAST_CHUNK_SIZE bytes each (the last may be less)
+} ToastValue;
+
+// How much out-of-line text exists right now
+typedef struct {
+    _Atomic uint64_t values;
+    _Atomic uint64_t bytes;
+} ToastStats;
+
+// Global TOAST counters (only one exists)
+ToastStats toast_stats;
+
+// ----------------------------------------------------------------------------
+// ROW BLOCK
+// ----------------------------------------------------------------------------
+typedef enum {
+    STORE_FIXED,    // Number in the slot
+    STORE_INLINE,   // Text in this block, at `offset`
+    STORE_TOAST     // Text out of line, in `toast`
+} ColumnStorage;
+
+typedef struct {
+    uint8_t storage;      // A ColumnStorage
+    uint32_t length;      // Text length in bytes
+    union {
+        int64_t number;
+        uint32_t offset;  // From the start of the block
+        ToastValue* toast;
+    };
+} ColumnSlot;
+
+// A full version has a slot for every column. A delta only has slots
+// for the columns in column_mask (in column order); the rest are the
+// same as in the version below it.
+typedef struct RowData {
+    uint32_t size;        // Bytes in this block (slots + inline text)
+    uint32_t column_mask; // Bit c set = column c is stored here
+    uint8_t delta_depth;  // 0 = full version, else deltas since the last one
+    int column_count;     // Slots stored (one per bit in column_mask)
+    ColumnSlot columns[]; // Then the inline text bytes
+} RowData;
+
+int count_bits(uint32_t bits) {
+    int count = 0;
+    for (; bits; bits &= bits - 1) {
+        count++;
+    }
+    return count;
+}
+
+// Which slot holds column `column`? (-1 = not stored in this block)
+int row_slot_index(const RowData* row, int column) {
+    uint32_t bit = (uint32_t)1 << column;
+    if (!(row->column_mask & bit)) {
+        return -1;
+    }
+    return count_bits(row->column_mask & (bit - 1));
+}
+
+// Find a column for a version: walk down the chain until some version
+// stores it. *owner gets the block the slot lives in (inline text is
+// relative to it). The caller must be inside epoch_enter()/epoch_exit().
+const ColumnSlot* find_column(const Tuple* version, int column,
+                              const RowData** owner) {
+    for (; version && version->row; version = version->next_version) {
+        int index = row_slot_index(version->row, column);
+        if (index >= 0) {
+            *owner = version->row;
+            return &version->row->columns[index];
+        }
+        if (version->row->delta_depth == 0) {
+            break;  // A full version has every column, so it's not there
+        }
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// MAKE / SHARE / DROP A TOAST VALUE
+// ----------------------------------------------------------------------------
+ToastValue* toast_create(const char* text, uint32_t length) {
+    int chunk_count = (int)((length + TOAST_CHUNK_SIZE - 1) / TOAST_CHUNK_SIZE);
+    ToastValue* toast = (ToastValue*)malloc(sizeof(ToastValue) +
+                                            (size_t)chunk_count * sizeof(char*));
+    if (!toast) {
+        return NULL;
+    }
+    toast->refs = 1;
+    toast->length = length;
+    toast->chunk_count = 0;
+
+    for (int i = 0; i < chunk_count; i++) {
+        uint32_t start = (uint32_t)i * TOAST_CHUNK_SIZE;
+        uint32_t bytes = length - start < TOAST_CHUNK_SIZE
+            ? length - start : TOAST_CHUNK_SIZE;
+        char* chunk = (char*)malloc(bytes);
+        if (!chunk) {
+            for (int j = 0; j < toast->chunk_count; j++) {
+                free(toast->chunks[j]);
+            }
+            free(toast);
+            return NULL;
+        }
+        memcpy(chunk, text + start, bytes);
+        toast->chunks[toast->chunk_count++] = chunk;
+    }
+
+    atomic_fetch_add(&toast_stats.values, 1);
+    atomic_fetch_add(&toast_stats.bytes, length);
+    metrics_inc(METRIC_TOAST_CREATED);
+    return toast;
+}
+
+// Another version points at it now. (The caller holds a version that
+// already points at it, so it can't be freed under us.)
+void toast_share(ToastValue* toast) {
+    atomic_fetch_add_explicit(&toast->refs, 1, memory_order_relaxed);
+    metrics_inc(METRIC_TOAST_SHARED);
+}
+
+void toast_release(ToastValue* toast) {
+    if (atomic_fetch_sub_explicit(&toast->refs, 1, memory_order_acq_rel) != 1) {
+        return;  // Somebody else still needs it
+    }
+    for (int i = 0; i < toast->chunk_count; i++) {
+        free(toast->chunks[i]);
+    }
+    atomic_fetch_sub(&toast_stats.values, 1);
+    atomic_fetch_sub(&toast_stats.bytes, toast->length);
+    free(toast);
+}
+
+// ----------------------------------------------------------------------------
+// FREE A ROW
+// ----------------------------------------------------------------------------
+void free_row(RowData* row) {
+    if (!row) {
+        return;
+    }
+    for (int c = 0; c < row->column_count; c++) {
+        if (row->columns[c].storage == STORE_TOAST) {
+            toast_release(row->columns[c].toast);
+        }
+    }
+    free(row);
+}
+
+// ----------------------------------------------------------------------------
+// BUILD A ROW
+// ----------------------------------------------------------------------------
+// Put a row together for a new version on top of `old` (NULL for an insert).
+// changed[c] is the new value for column c, or NULL to keep the old one.
+//
+// Usually only the changed columns are stored (a delta). But after
+// DELTA_CHAIN_MAX deltas in a row (or for an insert) every column is
+// stored: unchanged ones are found down the chain and copied, except
+// out-of-line values, which are shared, not copied.
+RowData* assemble_row(const Schema* schema, const Tuple* old,
+                      const Value* const* changed) {
+    int count = schema->column_count;
+    bool full = !old || !old->row ||
+                old->row->delta_depth >= DELTA_CHAIN_MAX;
+
+    // Which columns go in, and where do the kept ones come from?
+    uint32_t mask = 0;
+    const ColumnSlot* kept[MAX_COLUMNS] = {0};
+    const RowData* kept_owner[MAX_COLUMNS] = {0};
+    for (int c = 0; c < count; c++) {
+        if (changed[c]) {
+            mask |= (uint32_t)1 << c;
+        } else if (full) {
+            kept[c] = find_column(old, c, &kept_owner[c]);
+            if (!kept[c]) {
+                return NULL;  // Nothing to keep (a broken chain)
+            }
+            mask |= (uint32_t)1 << c;
+        }
+    }
+    int stored = count_bits(mask);
+
+    // First pass: how much inline text is there?
+    size_t header = sizeof(RowData) + (size_t)stored * sizeof(ColumnSlot);
+    size_t inline_bytes = 0;
+    for (int c = 0; c < count; c++) {
+        if (schema->columns[c].type != COL_TEXT) {
+            continue;
+        }
+        if (changed[c]) {
+            if (changed[c]->length <= TOAST_THRESHOLD) {
+                inline_bytes += changed[c]->length;
+            }
+        } else if (kept[c] && kept[c]->storage == STORE_INLINE) {
+            inline_bytes += kept[c]->length;
+        }
+    }
+
+    RowData* row = (RowData*)malloc(header + inline_bytes);
+    if (!row) {
+        return NULL;
+    }
+    row->size = (uint32_t)(header + inline_bytes);
+    row->column_mask = mask;
+    row->delta_depth = full ? 0 : (uint8_t)(old->row->delta_depth + 1);
+    row->column_count = 0;
+
+    // Second pass: fill in the slots
+    uint32_t next_offset = (uint32_t)header;
+    for (int c = 0; c < count; c++) {
+        if (!(mask & ((uint32_t)1 << c))) {
+            continue;
+        }
+        ColumnSlot* slot = &row->columns[row->column_count];
+        const Value* value = changed[c];
+
+        if (!value) {
+            *slot = *kept[c];
+            if (slot->storage == STORE_INLINE) {
+                memcpy((char*)row + next_offset,
+                       (const char*)kept_owner[c] + kept[c]->offset,
+                       slot->length);
+                slot->offset = next_offset;
+                next_offset += slot->length;
+            } else if (slot->storage == STORE_TOAST) {
+                toast_share(slot->toast);
+            }
+        } else if (schema->columns[c].type != COL_TEXT) {
+            slot->storage = STORE_FIXED;
+            slot->length = 0;
+            slot->number = value->number;
+        } else if (value->length <= TOAST_THRESHOLD) {
+            slot->storage = STORE_INLINE;
+            slot->length = value->length;
+            slot->offset = next_offset;
+            memcpy((char*)row + next_offset, value->text, value->length);
+            next_offset += value->length;
+        } else {
+            slot->storage = STORE_TOAST;
+            slot->length = value->length;
+            slot->toast = toast_create(value->text, value->length);
+            if (!slot->toast) {
+                free_row(row);  // Gives back what we took so far
+                return NULL;
+            }
+        }
+        row->column_count++;
+    }
+
+    metrics_inc(full ? METRIC_FULL_VERSIONS : METRIC_DELTA_VERSIONS);
+    return row;
+}
+
+// Is this value the right kind for the column?
+bool value_fits_column(const Schema* schema, int column, const Value* value) {
+    return column >= 0 && column < schema->column_count &&
+           value->type == schema->columns[column].type &&
+           (value->type != COL_TEXT || value->text || value->length == 0);
+}
+
+// ----------------------------------------------------------------------------
+// FREE A VERSION
+// ----------------------------------------------------------------------------
+// Used wherever a whole version is thrown away (also by limbo)
+void free_version(void* version) {
+    Tuple* tuple = (Tuple*)version;
+    free_row(tuple->row);
+    free(tuple);
+}
+
+// Memory a version owns by itself (shared TOAST values not included)
+size_t version_bytes(const Tuple* tuple) {
+    return sizeof(Tuple) + (tuple->row ? tuple->row->size : 0);
+}
+
+// ----------------------------------------------------------------------------
+// READ A COLUMN
+// ----------------------------------------------------------------------------
+// Numbers come back in out->number. Text is copied into `buffer` (at most
+// buffer_size bytes) and out->length is the FULL length, so a caller can
+// tell if its buffer was too small. If `version` is a delta that doesn't
+// have the column, it comes from the versions below it.
+bool row_get_column(const Schema* schema, const Tuple* version, int column,
+                    Value* out, char* buffer, size_t buffer_size) {
+    if (column < 0 || column >= schema->column_count) {
+        return false;
+    }
+    const RowData* row = NULL;
+    const ColumnSlot* slot = find_column(version, column, &row);
+    if (!slot) {
+        return false;
+    }
+    out->type = schema->columns[column].type;
+    out->number = 0;
+    out->text = NULL;
+    out->length = 0;
+
+    if (slot->storage == STORE_FIXED) {
+        out->number = slot->number;
+        return true;
+    }
+
+    out->length = slot->length;
+    out->text = buffer;
+    size_t wanted = slot->length < buffer_size ? slot->length : buffer_size;
+    if (slot->storage == STORE_INLINE) {
+        memcpy(buffer, (const char*)row + slot->offset, wanted);
+        return true;
+    }
+
+    // Glue the chunks back together ("detoast")
+    size_t copied = 0;
+    for (int i = 0; i < slot->toast->chunk_count && copied < wanted; i++) {
+        size_t bytes = wanted - copied < TOAST_CHUNK_SIZE
+            ? wanted - copied : TOAST_CHUNK_SIZE;
+        memcpy(buffer + copied, slot->toast->chunks[i], bytes);
+        copied += bytes;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,1338 @@
+/*--------------------------------------------------------------------------------
+ * This is a stress tester for the MVCC engine - like letting a whole class
+ * scribble in the magic notebook at once, writing down everything each
+ * kid saw, and then checking afterwards that nobody saw something that
+ * couldn't have happened.
+ *
+ * Two ways to run:
+ *   sessions  - One thread plays many "sessions" and a seeded random
+ *               number picks who goes next, so the same seed gives the
+ *               exact same history every time (it prints a digest).
+ *   threads   - Every session is a real thread (--threads N). Faster and
+ *               nastier, but the interleaving is up to the scheduler.
+ *               Threads yield after every step, so they overlap even on
+ *               one core.
+ *
+ * Every session runs random transactions: begin, read, update, delete,
+ * savepoint, rollback to savepoint, commit, abort. Every value written is
+ * unique, so a read tells us exactly which write it saw. Afterwards we
+ * build the dependency graph (Adya's ww / wr / rw edges) and look for what
+ * snapshot isolation forbids:
+ *   G0      - a cycle of write-write edges
+ *   G1a     - reading something that was aborted (or rolled back)
+ *   G1b     - reading something that was not the writer's final value
+ *   G1c     - a cycle of write-write / write-read edges
+ *   G-SIa   - seeing a commit that happened after we started
+ *   G-SIb   - a cycle with exactly one read-write (anti-dependency) edge,
+ *             e.g. missing a commit that happened before we started
+ *   lost update - two committed writers replaced the same version
+ *
+ * Usage: ./mvcc_stress [options]   (./mvcc_stress --help for the list)
+ * Exits with 1 if it found anything. "make test" runs a few seeds, and
+ * also a threaded run against an engine built with MVCC_INJECT_FAULT
+ * (snapshots that forget who was running), which must be caught.
+ * ---------------------------------------------------------------------------------
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mvcc_types.h"
+#include "mvcc_transaction_manager.h"
+#include "mvcc_visibility.h"
+#include "mvcc_table.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+// Rows past the normal keys are the only ones that may be deleted, so
+// the normal keys stay alive for the whole run
+#define DELETABLE_KEYS 4
+
+// A version ID is (session + 1) << VERSION_SESSION_SHIFT | counter.
+// Session "0" is the setup transaction that loads the table.
+#define VERSION_SESSION_SHIFT 20
+#define MAX_SESSIONS 64
+#define MAX_VERSIONS_PER_SESSION ((1 << VERSION_SESSION_SHIFT) - 1)
+
+// "There was no visible row"
+#define NO_VALUE 0
+
+// Print at most this many anomalies of each kind
+#define MAX_REPORTS 5
+
+// ----------------------------------------------------------------------------
+// CONFIGURATION
+// ----------------------------------------------------------------------------
+typedef struct {
+    int sessions;          // Logical sessions (one thread plays them all)
+    int threads;           // > 0: one real thread per session instead
+    int txns;              // Transactions per session
+    int max_ops;           // Operations per transaction (1..max_ops)
+    int keys;              // Rows that are read and updated
+    int read_only_pct;     // % of transactions begun read-only
+    int abort_pct;         // % of transactions that abort at the end
+    MvccMode mode;
+    int shards;
+    int vacuum_every;      // Sessions: vacuum every N steps (0 = never)
+    int idle_timeout_us;   // Threads: terminate idle snapshots (0 = never)
+    uint64_t seed;
+    bool self_check;       // Check the checker on histories with known bugs
+} StressConfig;
+
+StressConfig config = {
+    .sessions = 8,
+    .threads = 0,
+    .txns = 400,
+    .max_ops = 6,
+    .keys = 8,
+    .read_only_pct = 30,
+    .abort_pct = 10,
+    .mode = MVCC_MODE_XID,
+    .shards = 1,
+    .vacuum_every = 50,
+    .idle_timeout_us = 0,
+    .seed = 1,
+    .self_check = false,
+};
+
+// ----------------------------------------------------------------------------
+// RANDOM NUMBERS
+// ----------------------------------------------------------------------------
+// xorshift64*: small, fast, and every session gets its own seed
+uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+int random_below(uint64_t* state, int n) {
+    return (int)(next_random(state) % (uint64_t)n);
+}
+
+// ----------------------------------------------------------------------------
+// HISTORY
+// ----------------------------------------------------------------------------
+// What each transaction did, in order. Only the session that owns a log
+// writes to it, so recording needs no locks.
+typedef enum {
+    OP_READ,       // value = what we saw (NO_VALUE = no visible row)
+    OP_WRITE,      // value = the new version, replaced = the one it replaced
+    OP_DELETE,     // Like a write, but the new "version" is "gone"
+    OP_ROLLBACK    // Rolled back to a savepoint; replaced = op position
+} OpKind;
+
+typedef struct {
+    uint8_t kind;
+    int key;
+    int32_t value;
+    int32_t replaced;
+} HistOp;
+
+// The logical clock is read right before and right after begin and
+// commit/abort, so we know for sure when one transaction committed
+// before another one started (or after it).
+typedef struct {
+    int session;
+    uint64_t begin_lo, begin_hi;
+    uint64_t end_lo, end_hi;
+    bool committed;
+    bool read_only;
+    int first_op;
+    int op_count;
+} HistTxn;
+
+typedef struct {
+    HistTxn* txns;
+    int txn_count;
+    int txn_capacity;
+    HistOp* ops;
+    int op_count;
+    int op_capacity;
+} History;
+
+// One global clock for the intervals above
+_Atomic uint64_t history_clock = 1;
+
+uint64_t tick() {
+    return atomic_fetch_add(&history_clock, 1);
+}
+
+HistTxn* history_add_txn(History* h) {
+    if (h->txn_count == h->txn_capacity) {
+        h->txn_capacity = h->txn_capacity ? h->txn_capacity * 2 : 256;
+        h->txns = (HistTxn*)realloc(h->txns, (size_t)h->txn_capacity * sizeof(HistTxn));
+        if (!h->txns) {
+            fprintf(stderr, "Out of memory\n");
+            exit(2);
+        }
+    }
+    HistTxn* txn = &h->txns[h->txn_count++];
+    memset(txn, 0, sizeof(HistTxn));
+    txn->first_op = h->op_count;
+    return txn;
+}
+
+void history_add_op(History* h, HistTxn* txn, OpKind kind, int key,
+                    int32_t value, int32_t replaced) {
+    if (h->op_count == h->op_capacity) {
+        h->op_capacity = h->op_capacity ? h->op_capacity * 2 : 1024;
+        h->ops = (HistOp*)realloc(h->ops, (size_t)h->op_capacity * sizeof(HistOp));
+        if (!h->ops) {
+            fprintf(stderr, "Out of memory\n");
+            exit(2);
+        }
+    }
+    h->ops[h->op_count++] = (HistOp){(uint8_t)kind, key, value, replaced};
+    txn->op_count++;
+}
+
+void free_history(History* h) {
+    free(h->txns);
+    free(h->ops);
+    memset(h, 0, sizeof(History));
+}
+
+// ----------------------------------------------------------------------------
+// SESSION
+// ----------------------------------------------------------------------------
+typedef struct {
+    int id;
+    uint64_t rng;
+    History log;
+    int versions_made;     // Counter for our version IDs
+    Transaction* tx;       // Current transaction (NULL = between them)
+    HistTxn* txn;          // ...and its record
+    int ops_left;
+    int savepoint;         // Open savepoint (-1 = none)
+    int savepoint_mark;    // Our op count when it was placed
+    int txns_done;
+} Session;
+
+int32_t new_version_id(Session* s) {
+    return (int32_t)(((uint32_t)(s->id + 1) << VERSION_SESSION_SHIFT) |
+                     (uint32_t)++s->versions_made);
+}
+
+int pick_key(Session* s, bool may_delete) {
+    if (may_delete) {
+        return config.keys + random_below(&s->rng, DELETABLE_KEYS);
+    }
+    return random_below(&s->rng, config.keys + DELETABLE_KEYS);
+}
+
+// Start the next transaction
+void session_begin(Session* s) {
+    bind_thread_to_shard(s->id % config.shards);
+    bool read_only = random_below(&s->rng, 100) < config.read_only_pct;
+    uint64_t lo = tick();
+    Transaction* tx = read_only ? begin_read_only_transaction()
+                                : begin_transaction();
+    uint64_t hi = tick();
+    if (!tx) {
+        return;  // Out of slots for a moment; try again next step
+    }
+    s->tx = tx;
+    s->txn = history_add_txn(&s->log);
+    s->txn->session = s->id;
+    s->txn->read_only = read_only;
+    s->txn->begin_lo = lo;
+    s->txn->begin_hi = hi;
+    s->ops_left = 1 + random_below(&s->rng, config.max_ops);
+    s->savepoint = -1;
+}
+
+// Finish the current transaction (commit = false means abort)
+void session_end(Session* s, bool commit) {
+    s->txn->end_lo = tick();
+    if (commit) {
+        s->txn->committed = commit_transaction(s->tx);
+    } else {
+        abort_transaction(s->tx);
+        s->txn->committed = false;
+    }
+    s->txn->end_hi = tick();
+    s->tx = NULL;
+    s->txn = NULL;
+    s->txns_done++;
+}
+
+// Did the operation fail because we were terminated for idling?
+bool was_terminated(Session* s) {
+    return atomic_load(&s->tx->activity) == TX_TERMINATED;
+}
+
+// Read a key and write down what we saw. Returns false if we should stop.
+bool session_read(Session* s, int key, int32_t* seen) {
+    int32_t data;
+    if (!read_tuple(s->tx, key, &data)) {
+        if (was_terminated(s)) {
+            return false;
+        }
+        data = NO_VALUE;
+    }
+    history_add_op(&s->log, s->txn, OP_READ, key, data, 0);
+    *seen = data;
+    return true;
+}
+
+// Do one random operation. Returns false if the transaction has to end
+// early (a write conflict, or we were terminated).
+bool session_operate(Session* s) {
+    int roll = random_below(&s->rng, 100);
+    Transaction* tx = s->tx;
+    int32_t seen;
+
+    // Read-only transactions mostly just read (but may change their mind)
+    if (s->txn->read_only && roll < 90) {
+        roll = 0;
+    }
+
+    if (roll < 50) {
+        return session_read(s, pick_key(s, false), &seen);
+    }
+
+    if (roll < 85 || roll >= 97) {
+        // Read-modify-write, or read-delete on a deletable row
+        bool deleting = roll >= 97;
+        int key = pick_key(s, deleting);
+        if (!session_read(s, key, &seen)) {
+            return false;
+        }
+        if (seen == NO_VALUE) {
+            return true;  // Nothing there to change
+        }
+        int32_t version = new_version_id(s);
+        bool ok = deleting ? delete_tuple(tx, key)
+                           : update_tuple(tx, key, version);
+        if (!ok) {
+            return false;  // Someone else got there first: abort
+        }
+        history_add_op(&s->log, s->txn, deleting ? OP_DELETE : OP_WRITE,
+                       key, version, seen);
+        return true;
+    }
+
+    if (roll < 91 || s->savepoint < 0) {
+        int savepoint = create_savepoint(tx);
+        if (savepoint >= 0) {
+            s->savepoint = savepoint;
+            s->savepoint_mark = s->txn->op_count;
+        }
+        return savepoint >= 0 || !was_terminated(s);
+    }
+
+    if (!rollback_to_savepoint(tx, s->savepoint)) {
+        return !was_terminated(s);
+    }
+    history_add_op(&s->log, s->txn, OP_ROLLBACK, 0, 0, s->savepoint_mark);
+    return true;
+}
+
+// One step: begin, do one operation, or finish
+void session_step(Session* s) {
+    if (!s->tx) {
+        session_begin(s);
+        return;
+    }
+    if (s->ops_left == 0) {
+        session_end(s, random_below(&s->rng, 100) >= config.abort_pct);
+        return;
+    }
+    s->ops_left--;
+    if (!session_operate(s)) {
+        session_end(s, false);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// RUN: LOGICAL SESSIONS (DETERMINISTIC)
+// ----------------------------------------------------------------------------
+void run_sessions(Session* sessions, int count) {
+    uint64_t rng = config.seed * 0x9E3779B97F4A7C15ull + 7;
+    int running = count;
+    uint64_t steps = 0;
+
+    while (running > 0) {
+        // Pick a session that still has work
+        int pick = random_below(&rng, running);
+        Session* s = NULL;
+        for (int i = 0; i < count; i++) {
+            if (sessions[i].txns_done < config.txns && pick-- == 0) {
+                s = &sessions[i];
+                break;
+            }
+        }
+        session_step(s);
+        if (s->txns_done == config.txns) {
+            running--;
+        }
+
+        steps++;
+        if (config.vacuum_every > 0 && steps % (uint64_t)config.vacuum_every == 0) {
+            int total_versions;
+            vacuum_pass(&total_versions);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// RUN: REAL THREADS
+// ----------------------------------------------------------------------------
+_Atomic bool stop_flag;
+
+// After every step we let the other threads go first. Otherwise, with
+// fewer cores than threads, a thread could finish whole transactions in
+// one time slice and the sessions would hardly overlap at all.
+int session_thread(void* arg) {
+    Session* s = (Session*)arg;
+    while (s->txns_done < config.txns) {
+        session_step(s);
+        thrd_yield();
+    }
+    epoch_unregister_thread();
+    metrics_unregister_thread();
+    return 0;
+}
+
+int vacuum_thread(void* arg) {
+    (void)arg;
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 100000L};
+    while (!atomic_load(&stop_flag)) {
+        int total_versions;
+        if (config.idle_timeout_us > 0) {
+            abort_idle_snapshots((uint64_t)config.idle_timeout_us * 1000ull);
+        }
+        vacuum_pass(&total_versions);
+        thrd_sleep(&pause, NULL);
+    }
+    epoch_unregister_thread();
+    metrics_unregister_thread();
+    return 0;
+}
+
+// Returns false if a thread couldn't be started (the ones that did
+// start still finish, so nothing is left running)
+bool run_threads(Session* sessions, int count) {
+    thrd_t* threads = (thrd_t*)calloc((size_t)count, sizeof(thrd_t));
+    if (!threads) {
+        return false;
+    }
+    thrd_t vacuum;
+    atomic_store(&stop_flag, false);
+    bool vacuum_started = thrd_create(&vacuum, vacuum_thread, NULL) == thrd_success;
+    int started = 0;
+    while (vacuum_started && started < count &&
+           thrd_create(&threads[started], session_thread,
+                       &sessions[started]) == thrd_success) {
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
+    atomic_store(&stop_flag, true);
+    if (vacuum_started) {
+        thrd_join(vacuum, NULL);
+    }
+    free(threads);
+    return started == count;
+}
+
+// ----------------------------------------------------------------------------
+// ONE HISTORY FOR THE CHECKER
+// ----------------------------------------------------------------------------
+// Transaction 0 is the setup transaction that wrote every row's first
+// version (IDs 1..rows); then every session's transactions follow.
+void add_setup_txn(History* h, int rows) {
+    HistTxn* setup = history_add_txn(h);
+    setup->session = -1;
+    setup->committed = true;
+    for (int key = 0; key < rows; key++) {
+        history_add_op(h, setup, OP_WRITE, key, key + 1, NO_VALUE);
+    }
+}
+
+void merge_histories(History* all, Session* sessions, int count) {
+    add_setup_txn(all, config.keys + DELETABLE_KEYS);
+    for (int i = 0; i < count; i++) {
+        History* log = &sessions[i].log;
+        for (int t = 0; t < log->txn_count; t++) {
+            HistTxn* from = &log->txns[t];
+            HistTxn* txn = history_add_txn(all);
+            int first_op = txn->first_op;
+            *txn = *from;
+            txn->first_op = first_op;
+            txn->op_count = 0;
+            for (int o = 0; o < from->op_count; o++) {
+                HistOp* op = &log->ops[from->first_op + o];
+                history_add_op(all, txn, (OpKind)op->kind, op->key,
+                               op->value, op->replaced);
+            }
+        }
+    }
+}
+
+// A fingerprint of the whole history (FNV-1a), to show a seed replays
+uint64_t history_digest(History* h) {
+    uint64_t hash = 1469598103934665603ull;
+    for (int t = 0; t < h->txn_count; t++) {
+        HistTxn* txn = &h->txns[t];
+        uint64_t words[3] = {(uint64_t)txn->session, txn->committed,
+                             (uint64_t)txn->op_count};
+        for (int w = 0; w < 3; w++) {
+            hash = (hash ^ words[w]) * 1099511628211ull;
+        }
+        for (int o = 0; o < txn->op_count; o++) {
+            HistOp* op = &h->ops[txn->first_op + o];
+            uint64_t packed = ((uint64_t)op->kind << 56) ^ ((uint64_t)op->key << 40) ^
+                              ((uint64_t)(uint32_t)op->value << 20) ^
+                              (uint64_t)(uint32_t)op->replaced;
+            hash = (hash ^ packed) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+// ----------------------------------------------------------------------------
+// CHECKER: ANOMALY REPORTS
+// ----------------------------------------------------------------------------
+typedef enum {
+    ANOMALY_G0,
+    ANOMALY_G1A,
+    ANOMALY_G1B,
+    ANOMALY_G1C,
+    ANOMALY_GSIA,
+    ANOMALY_GSIB,
+    ANOMALY_LOST_UPDATE,
+    ANOMALY_OWN_WRITES,
+    ANOMALY_COUNT
+} AnomalyKind;
+
+const char* anomaly_names[ANOMALY_COUNT] = {
+    "G0", "G1a", "G1b", "G1c", "G-SIa", "G-SIb", "lost update", "own writes",
+};
+
+typedef struct {
+    int counts[ANOMALY_COUNT];
+    bool quiet;   // The self-check doesn't print details
+} Report;
+
+void report(Report* r, AnomalyKind kind, const char* format, ...) {
+    if (r->counts[kind]++ >= MAX_REPORTS || r->quiet) {
+        return;
+    }
+    printf("  %s: ", anomaly_names[kind]);
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+int total_anomalies(Report* r) {
+    int total = 0;
+    for (int k = 0; k < ANOMALY_COUNT; k++) {
+        total += r->counts[k];
+    }
+    return total;
+}
+
+// ----------------------------------------------------------------------------
+// CHECKER: FIND A VERSION'S WRITER
+// ----------------------------------------------------------------------------
+// Open addressing: version ID -> op index of the write that made it
+typedef struct {
+    int32_t* ids;
+    int* ops;
+    int size;
+} VersionIndex;
+
+void version_index_init(VersionIndex* index, int writes) {
+    index->size = 16;
+    while (index->size < writes * 2) {
+        index->size *= 2;
+    }
+    index->ids = (int32_t*)calloc((size_t)index->size, sizeof(int32_t));
+    index->ops = (int*)calloc((size_t)index->size, sizeof(int));
+}
+
+int* version_index_slot(VersionIndex* index, int32_t id) {
+    uint32_t mask = (uint32_t)index->size - 1;
+    uint32_t pos = ((uint32_t)id * 2654435761u) & mask;
+    while (index->ids[pos] != 0 && index->ids[pos] != id) {
+        pos = (pos + 1) & mask;
+    }
+    index->ids[pos] = id;
+    return &index->ops[pos];
+}
+
+// -1 = no such write
+int version_index_find(VersionIndex* index, int32_t id) {
+    uint32_t mask = (uint32_t)index->size - 1;
+    uint32_t pos = ((uint32_t)id * 2654435761u) & mask;
+    while (index->ids[pos] != 0) {
+        if (index->ids[pos] == id) {
+            return index->ops[pos];
+        }
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+void version_index_free(VersionIndex* index) {
+    free(index->ids);
+    free(index->ops);
+}
+
+// ----------------------------------------------------------------------------
+// CHECKER: DEPENDENCY GRAPH
+// ----------------------------------------------------------------------------
+typedef enum {
+    EDGE_WW,   // T1 wrote a version, T2 wrote the next one
+    EDGE_WR,   // T2 read what T1 wrote
+    EDGE_RW    // T1 read a version, T2 wrote the next one (anti-dependency)
+} EdgeKind;
+
+typedef struct {
+    int from;
+    int to;
+    uint8_t kind;
+} Edge;
+
+typedef struct {
+    Edge* edges;
+    int count;
+    int capacity;
+    int per_kind[3];
+} EdgeList;
+
+void add_edge(EdgeList* list, int from, int to, EdgeKind kind) {
+    if (from == to) {
+        return;
+    }
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->edges = (Edge*)realloc(list->edges, (size_t)list->capacity * sizeof(Edge));
+        if (!list->edges) {
+            fprintf(stderr, "Out of memory\n");
+            exit(2);
+        }
+    }
+    list->edges[list->count++] = (Edge){from, to, (uint8_t)kind};
+    list->per_kind[kind]++;
+}
+
+// Adjacency lists (CSR) over the edges of the chosen kinds
+typedef struct {
+    int* start;   // Edges of node n are targets[start[n] .. start[n+1])
+    int* targets;
+} Graph;
+
+void build_graph(Graph* g, EdgeList* list, int nodes, bool with_wr) {
+    g->start = (int*)calloc((size_t)nodes + 1, sizeof(int));
+    g->targets = (int*)malloc(((size_t)list->count + 1) * sizeof(int));
+    for (int e = 0; e < list->count; e++) {
+        Edge* edge = &list->edges[e];
+        if (edge->kind == EDGE_WW || (with_wr && edge->kind == EDGE_WR)) {
+            g->start[edge->from + 1]++;
+        }
+    }
+    for (int n = 0; n < nodes; n++) {
+        g->start[n + 1] += g->start[n];
+    }
+    int* fill = (int*)malloc(((size_t)nodes + 1) * sizeof(int));
+    memcpy(fill, g->start, ((size_t)nodes + 1) * sizeof(int));
+    for (int e = 0; e < list->count; e++) {
+        Edge* edge = &list->edges[e];
+        if (edge->kind == EDGE_WW || (with_wr && edge->kind == EDGE_WR)) {
+            g->targets[fill[edge->from]++] = edge->to;
+        }
+    }
+    free(fill);
+}
+
+void free_graph(Graph* g) {
+    free(g->start);
+    free(g->targets);
+}
+
+// Does the graph have a cycle? (Kahn: peel off nodes nobody points to;
+// whatever is left sits on a cycle.) Returns a node on one, or -1.
+int find_cycle(Graph* g, int nodes) {
+    int* incoming = (int*)calloc((size_t)nodes, sizeof(int));
+    int* queue = (int*)malloc((size_t)nodes * sizeof(int));
+    for (int n = 0; n < nodes; n++) {
+        for (int i = g->start[n]; i < g->start[n + 1]; i++) {
+            incoming[g->targets[i]]++;
+        }
+    }
+    int head = 0, tail = 0;
+    for (int n = 0; n < nodes; n++) {
+        if (incoming[n] == 0) {
+            queue[tail++] = n;
+        }
+    }
+    while (head < tail) {
+        int n = queue[head++];
+        for (int i = g->start[n]; i < g->start[n + 1]; i++) {
+            if (--incoming[g->targets[i]] == 0) {
+                queue[tail++] = g->targets[i];
+            }
+        }
+    }
+    int on_cycle = -1;
+    for (int n = 0; n < nodes && on_cycle < 0; n++) {
+        if (incoming[n] > 0) {
+            on_cycle = n;
+        }
+    }
+    free(incoming);
+    free(queue);
+    return on_cycle;
+}
+
+// ----------------------------------------------------------------------------
+// CHECKER
+// ----------------------------------------------------------------------------
+typedef struct {
+    History* h;
+    int* op_txn;         // Which transaction each op belongs to
+    bool* undone;        // Write rolled back by a savepoint rollback
+    bool* final_write;   // Last surviving write of its txn on that key
+    bool* covered;       // Op on a key its txn had a live write on
+    int* next_op;        // Version (final write op) -> op that replaced it
+    int* deleted_by;     // Key -> committed delete op (-1 = none)
+    VersionIndex versions;
+    EdgeList edges;
+    Report* report;
+} Checker;
+
+const char* describe_txn(Checker* c, int t, char* buffer, size_t size) {
+    HistTxn* txn = &c->h->txns[t];
+    if (txn->session < 0) {
+        snprintf(buffer, size, "setup");
+    } else {
+        snprintf(buffer, size, "T%d (session %d)", t, txn->session);
+    }
+    return buffer;
+}
+
+// Pass 1: replay each transaction on its own. Work out which writes were
+// rolled back and which ones are final, and check that a transaction
+// always sees its own latest write.
+void check_own_writes(Checker* c) {
+    History* h = c->h;
+    int32_t own[MAX_TUPLES];
+    bool has_own[MAX_TUPLES];
+
+    for (int t = 0; t < h->txn_count; t++) {
+        HistTxn* txn = &h->txns[t];
+        memset(has_own, 0, sizeof(has_own));
+
+        for (int o = 0; o < txn->op_count; o++) {
+            int index = txn->first_op + o;
+            HistOp* op = &h->ops[index];
+            c->op_txn[index] = t;
+            c->covered[index] = op->kind != OP_ROLLBACK && has_own[op->key];
+
+            if (op->kind == OP_ROLLBACK) {
+                // Everything since the savepoint never happened
+                memset(has_own, 0, sizeof(has_own));
+                for (int p = 0; p < o; p++) {
+                    HistOp* earlier = &h->ops[txn->first_op + p];
+                    bool is_write = earlier->kind == OP_WRITE ||
+                                    earlier->kind == OP_DELETE;
+                    if (is_write && p >= op->replaced) {
+                        c->undone[txn->first_op + p] = true;
+                    }
+                    if (is_write && !c->undone[txn->first_op + p]) {
+                        has_own[earlier->key] = true;
+                        own[earlier->key] =
+                            earlier->kind == OP_DELETE ? NO_VALUE : earlier->value;
+                    }
+                }
+            } else if (op->kind == OP_READ) {
+                if (has_own[op->key] && op->value != own[op->key]) {
+                    char who[48];
+                    report(c->report, ANOMALY_OWN_WRITES,
+                           "%s read %d from row %d but its own write was %d",
+                           describe_txn(c, t, who, sizeof(who)),
+                           op->value, op->key, own[op->key]);
+                }
+            } else {
+                has_own[op->key] = true;
+                own[op->key] = op->kind == OP_DELETE ? NO_VALUE : op->value;
+            }
+        }
+
+        // The last surviving write on each key is the one others can see
+        for (int o = txn->op_count - 1; o >= 0; o--) {
+            int index = txn->first_op + o;
+            HistOp* op = &h->ops[index];
+            if ((op->kind == OP_WRITE || op->kind == OP_DELETE) &&
+                !c->undone[index] && has_own[op->key]) {
+                c->final_write[index] = true;
+                has_own[op->key] = false;
+            }
+        }
+    }
+}
+
+// The first surviving write of transaction t on this key: what it
+// replaced is the version it built on
+int base_write(Checker* c, int t, int key) {
+    HistTxn* txn = &c->h->txns[t];
+    for (int o = 0; o < txn->op_count; o++) {
+        int index = txn->first_op + o;
+        HistOp* op = &c->h->ops[index];
+        if ((op->kind == OP_WRITE || op->kind == OP_DELETE) &&
+            op->key == key && !c->undone[index]) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// Which op wrote this version of this key? (A missing row was "written"
+// by the committed delete.) -1 = nobody.
+int find_writer_op(Checker* c, int32_t value, int key) {
+    return value == NO_VALUE ? c->deleted_by[key]
+                             : version_index_find(&c->versions, value);
+}
+
+// Pass 2: the version order. A committed transaction's final write on a
+// key replaced the version its first write on that key built on.
+void build_version_order(Checker* c) {
+    History* h = c->h;
+    for (int i = 0; i < h->op_count; i++) {
+        HistOp* op = &h->ops[i];
+        if (op->kind == OP_WRITE || op->kind == OP_DELETE) {
+            *version_index_slot(&c->versions, op->value) = i;
+        }
+    }
+
+    for (int i = 0; i < h->op_count; i++) {
+        int t = c->op_txn[i];
+        HistOp* op = &h->ops[i];
+        if (!c->final_write[i] || !h->txns[t].committed) {
+            continue;
+        }
+        if (op->kind == OP_DELETE) {
+            if (c->deleted_by[op->key] >= 0) {
+                report(c->report, ANOMALY_LOST_UPDATE,
+                       "row %d was deleted by two committed transactions",
+                       op->key);
+            }
+            c->deleted_by[op->key] = i;
+        }
+
+        int base = base_write(c, t, op->key);
+        int replaced_op = find_writer_op(c, h->ops[base].replaced, op->key);
+        if (replaced_op < 0 || t == 0) {
+            continue;  // Checked in pass 3
+        }
+        if (c->next_op[replaced_op] >= 0) {
+            char who[48], other[48];
+            report(c->report, ANOMALY_LOST_UPDATE,
+                   "%s and %s both replaced version %d of row %d",
+                   describe_txn(c, c->op_txn[c->next_op[replaced_op]], other,
+                                sizeof(other)),
+                   describe_txn(c, t, who, sizeof(who)),
+                   h->ops[base].replaced, op->key);
+        }
+        c->next_op[replaced_op] = i;
+    }
+}
+
+// Pass 3: for everything a committed transaction saw (reads, and the
+// versions its writes built on), find the writer and add the edges.
+void check_dependency(Checker* c, int t, int32_t value, int key,
+                      EdgeKind kind, bool read) {
+    History* h = c->h;
+    HistTxn* txn = &h->txns[t];
+    char who[48], other[48];
+    describe_txn(c, t, who, sizeof(who));
+
+    int writer_op = find_writer_op(c, value, key);
+    if (writer_op < 0) {
+        report(c->report, ANOMALY_G1A, "%s saw %s of row %d, which nobody committed",
+               who, value == NO_VALUE ? "no version" : "a version", key);
+        return;
+    }
+    int w = c->op_txn[writer_op];
+    if (w == t) {
+        // Ops after our own live writes were checked in pass 1, so we
+        // saw one we rolled back (or haven't made yet)
+        if (c->undone[writer_op]) {
+            report(c->report, ANOMALY_G1A,
+                   "%s saw version %d of row %d, which it rolled back",
+                   who, value, key);
+        } else {
+            report(c->report, ANOMALY_OWN_WRITES,
+                   "%s saw version %d of row %d before writing it",
+                   who, value, key);
+        }
+        return;
+    }
+    HistTxn* writer = &h->txns[w];
+    describe_txn(c, w, other, sizeof(other));
+
+    if (!writer->committed || c->undone[writer_op]) {
+        report(c->report, ANOMALY_G1A, "%s saw version %d of row %d, but %s %s",
+               who, value, key, other,
+               writer->committed ? "rolled it back" : "aborted");
+        return;
+    }
+    if (!c->final_write[writer_op]) {
+        report(c->report, ANOMALY_G1B,
+               "%s saw version %d of row %d, which %s later overwrote",
+               who, value, key, other);
+        return;
+    }
+    add_edge(&c->edges, w, t, kind);
+
+    // The writer must have committed before we started
+    if (writer->end_lo > txn->begin_hi) {
+        report(c->report, ANOMALY_GSIA,
+               "%s saw version %d of row %d, but %s committed after it started",
+               who, value, key, other);
+    }
+
+    // And nothing newer may have committed before we started
+    int next = c->next_op[writer_op];
+    if (read && next >= 0 && c->op_txn[next] != t) {
+        int k = c->op_txn[next];
+        add_edge(&c->edges, t, k, EDGE_RW);
+        if (h->txns[k].end_hi < txn->begin_lo) {
+            report(c->report, ANOMALY_GSIB,
+                   "%s read version %d of row %d, missing %s that committed "
+                   "before it started",
+                   who, value, key, describe_txn(c, k, other, sizeof(other)));
+        }
+    }
+}
+
+void check_dependencies(Checker* c) {
+    History* h = c->h;
+    for (int t = 1; t < h->txn_count; t++) {
+        HistTxn* txn = &h->txns[t];
+        if (!txn->committed) {
+            continue;  // Aborted transactions may have seen anything
+        }
+        for (int o = 0; o < txn->op_count; o++) {
+            int index = txn->first_op + o;
+            HistOp* op = &h->ops[index];
+            if (c->covered[index]) {
+                continue;  // We saw our own write (checked in pass 1)
+            }
+            if (op->kind == OP_READ) {
+                check_dependency(c, t, op->value, op->key, EDGE_WR, true);
+            } else if (op->kind != OP_ROLLBACK && !c->undone[index]) {
+                check_dependency(c, t, op->replaced, op->key, EDGE_WW, false);
+            }
+        }
+    }
+}
+
+// Pass 4: cycles. A ww-only cycle is G0, a ww/wr cycle is G1c, and a
+// cycle with exactly one rw edge is G-SIb: for every rw edge T -> K we
+// look for a ww/wr path back from K to T. Such a path only runs through
+// transactions that committed before T did (unless some edge on it is
+// already G-SIa), so we don't look further than that.
+void check_cycles(Checker* c) {
+    History* h = c->h;
+    int nodes = h->txn_count;
+    Graph ww, dependencies;
+    build_graph(&ww, &c->edges, nodes, false);
+    build_graph(&dependencies, &c->edges, nodes, true);
+
+    char who[48];
+    int node = find_cycle(&ww, nodes);
+    if (node >= 0) {
+        report(c->report, ANOMALY_G0, "write cycle through %s",
+               describe_txn(c, node, who, sizeof(who)));
+    } else if ((node = find_cycle(&dependencies, nodes)) >= 0) {
+        report(c->report, ANOMALY_G1C, "write/read cycle through %s",
+               describe_txn(c, node, who, sizeof(who)));
+    }
+
+    int* seen = (int*)calloc((size_t)nodes, sizeof(int));
+    int* stack = (int*)malloc((size_t)nodes * sizeof(int));
+    for (int e = 0; e < c->edges.count; e++) {
+        Edge* edge = &c->edges.edges[e];
+        if (edge->kind != EDGE_RW) {
+            continue;
+        }
+        int t = edge->from;
+        uint64_t limit = h->txns[t].end_hi;
+        int mark = e + 1;
+        int depth = 0;
+        bool found = false;
+        stack[depth++] = edge->to;
+        seen[edge->to] = mark;
+        while (depth > 0 && !found) {
+            int n = stack[--depth];
+            for (int i = dependencies.start[n]; i < dependencies.start[n + 1]; i++) {
+                int next = dependencies.targets[i];
+                if (next == t) {
+                    found = true;
+                    break;
+                }
+                if (seen[next] != mark && h->txns[next].end_lo < limit) {
+                    seen[next] = mark;
+                    stack[depth++] = next;
+                }
+            }
+        }
+        if (found) {
+            char other[48];
+            report(c->report, ANOMALY_GSIB,
+                   "cycle with one anti-dependency: %s -rw-> %s -...-> back",
+                   describe_txn(c, t, who, sizeof(who)),
+                   describe_txn(c, edge->to, other, sizeof(other)));
+        }
+    }
+    free(seen);
+    free(stack);
+    free_graph(&ww);
+    free_graph(&dependencies);
+}
+
+// Check a whole history. Returns how many anomalies were found.
+int check_history(History* h, int rows, Report* r, int edge_counts[3]) {
+    Checker c;
+    memset(&c, 0, sizeof(c));
+    c.h = h;
+    c.report = r;
+    c.op_txn = (int*)calloc((size_t)h->op_count + 1, sizeof(int));
+    c.undone = (bool*)calloc((size_t)h->op_count + 1, sizeof(bool));
+    c.final_write = (bool*)calloc((size_t)h->op_count + 1, sizeof(bool));
+    c.covered = (bool*)calloc((size_t)h->op_count + 1, sizeof(bool));
+    c.next_op = (int*)malloc(((size_t)h->op_count + 1) * sizeof(int));
+    c.deleted_by = (int*)malloc((size_t)rows * sizeof(int));
+    for (int i = 0; i < h->op_count; i++) {
+        c.next_op[i] = -1;
+    }
+    for (int k = 0; k < rows; k++) {
+        c.deleted_by[k] = -1;
+    }
+    version_index_init(&c.versions, h->op_count);
+
+    check_own_writes(&c);
+    build_version_order(&c);
+    check_dependencies(&c);
+    check_cycles(&c);
+
+    if (edge_counts) {
+        memcpy(edge_counts, c.edges.per_kind, sizeof(c.edges.per_kind));
+    }
+    free(c.op_txn);
+    free(c.undone);
+    free(c.final_write);
+    free(c.covered);
+    free(c.next_op);
+    free(c.deleted_by);
+    free(c.edges.edges);
+    version_index_free(&c.versions);
+    return total_anomalies(r);
+}
+
+// ----------------------------------------------------------------------------
+// SELF-CHECK
+// ----------------------------------------------------------------------------
+// A checker that never complains proves nothing, so feed it tiny
+// histories with a known bug and make sure it finds each one.
+// Row 0 starts at version 1 (written by setup); times are made up.
+HistTxn* fake_txn(History* h, int session, uint64_t begin, uint64_t end,
+                  bool committed) {
+    HistTxn* txn = history_add_txn(h);
+    txn->session = session;
+    txn->begin_lo = txn->begin_hi = begin;
+    txn->end_lo = txn->end_hi = end;
+    txn->committed = committed;
+    return txn;
+}
+
+bool expect_anomaly(const char* name, History* h, AnomalyKind kind) {
+    Report r = {.quiet = true};
+    check_history(h, 2, &r, NULL);
+    bool ok = r.counts[kind] > 0;
+    printf("  %-38s %s\n", name, ok ? "found" : "MISSED");
+    free_history(h);
+    return ok;
+}
+
+bool run_self_check() {
+    printf("mvcc_stress: checking the checker\n");
+    bool ok = true;
+    History h = {0};
+
+    // T1 writes 100 and aborts; T2 reads 100
+    add_setup_txn(&h, 2);
+    HistTxn* t1 = fake_txn(&h, 0, 10, 20, false);
+    history_add_op(&h, t1, OP_WRITE, 0, 100, 1);
+    HistTxn* t2 = fake_txn(&h, 1, 30, 40, true);
+    history_add_op(&h, t2, OP_READ, 0, 100, 0);
+    ok &= expect_anomaly("aborted read (G1a)", &h, ANOMALY_G1A);
+
+    // T1 writes 100 then 101; T2 reads 100
+    add_setup_txn(&h, 2);
+    t1 = fake_txn(&h, 0, 10, 20, true);
+    history_add_op(&h, t1, OP_WRITE, 0, 100, 1);
+    history_add_op(&h, t1, OP_WRITE, 0, 101, 100);
+    t2 = fake_txn(&h, 1, 30, 40, true);
+    history_add_op(&h, t2, OP_READ, 0, 100, 0);
+    ok &= expect_anomaly("intermediate read (G1b)", &h, ANOMALY_G1B);
+
+    // T1 and T2 each read what the other wrote
+    add_setup_txn(&h, 2);
+    t1 = fake_txn(&h, 0, 10, 40, true);
+    history_add_op(&h, t1, OP_WRITE, 0, 100, 1);
+    history_add_op(&h, t1, OP_READ, 1, 200, 0);
+    t2 = fake_txn(&h, 1, 10, 40, true);
+    history_add_op(&h, t2, OP_WRITE, 1, 200, 2);
+    history_add_op(&h, t2, OP_READ, 0, 100, 0);
+    ok &= expect_anomaly("circular information flow (G1c)", &h, ANOMALY_G1C);
+
+    // T2 started before T1 committed, but saw T1's write
+    add_setup_txn(&h, 2);
+    t1 = fake_txn(&h, 0, 10, 30, true);
+    history_add_op(&h, t1, OP_WRITE, 0, 100, 1);
+    t2 = fake_txn(&h, 1, 20, 40, true);
+    history_add_op(&h, t2, OP_READ, 0, 100, 0);
+    ok &= expect_anomaly("saw a later commit (G-SIa)", &h, ANOMALY_GSIA);
+
+    // T1 committed before T2 started, but T2 read the old version
+    add_setup_txn(&h, 2);
+    t1 = fake_txn(&h, 0, 10, 20, true);
+    history_add_op(&h, t1, OP_WRITE, 0, 100, 1);
+    t2 = fake_txn(&h, 1, 30, 40, true);
+    history_add_op(&h, t2, OP_READ, 0, 1, 0);
+    ok &= expect_anomaly("missed an earlier commit (G-SIb)", &h, ANOMALY_GSIB);
+
+    // T2 reads row 0 twice and sees two different committed versions
+    add_setup_txn(&h, 2);
+    t1 = fake_txn(&h, 0, 10, 25, true);
+    history_add_op(&h, t1, OP_WRITE, 0, 100, 1);
+    t2 = fake_txn(&h, 1, 20, 40, true);
+    history_add_op(&h, t2, OP_READ, 0, 1, 0);
+    history_add_op(&h, t2, OP_READ, 0, 100, 0);
+    ok &= expect_anomaly("non-repeatable read (G-SIb cycle)", &h, ANOMALY_GSIB);
+
+    // T1 and T2 both update version 1 and both commit
+    add_setup_txn(&h, 2);
+    t1 = fake_txn(&h, 0, 10, 30, true);
+    history_add_op(&h, t1, OP_WRITE, 0, 100, 1);
+    t2 = fake_txn(&h, 1, 10, 40, true);
+    history_add_op(&h, t2, OP_WRITE, 0, 200, 1);
+    ok &= expect_anomaly("lost update", &h, ANOMALY_LOST_UPDATE);
+
+    // T1 writes 100, rolls it back, and still reads 100
+    add_setup_txn(&h, 2);
+    t1 = fake_txn(&h, 0, 10, 30, true);
+    history_add_op(&h, t1, OP_WRITE, 0, 100, 1);
+    history_add_op(&h, t1, OP_ROLLBACK, 0, 0, 0);
+    history_add_op(&h, t1, OP_READ, 0, 100, 0);
+    ok &= expect_anomaly("read a rolled-back write", &h, ANOMALY_G1A);
+
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// COMMAND LINE
+// ----------------------------------------------------------------------------
+void print_usage() {
+    printf("Usage: mvcc_stress [options]\n");
+    printf("  --sessions N          Logical sessions on one thread (default 8)\n");
+    printf("  --threads N           Use N real threads instead (not repeatable)\n");
+    printf("  --txns N              Transactions per session (default 400)\n");
+    printf("  --max-ops N           Operations per transaction, 1..N (default 6)\n");
+    printf("  --keys N              Rows to update (default 8, plus %d deletable)\n",
+           DELETABLE_KEYS);
+    printf("  --read-only-pct N     %% of transactions begun read-only (default 30)\n");
+    printf("  --abort-pct N         %% of transactions that abort (default 10)\n");
+    printf("  --mode xid|ts         MVCC mode (default xid)\n");
+    printf("  --shards N            Transaction manager shards (default 1)\n");
+    printf("  --vacuum-every N      Sessions: vacuum every N steps, 0 = off (default 50)\n");
+    printf("  --idle-timeout-us N   Threads: terminate snapshots idle this long\n");
+    printf("  --seed N              Random seed (default 1)\n");
+    printf("  --self-check          Make sure the checker catches known anomalies\n");
+}
+
+bool parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--help") == 0) {
+            print_usage();
+            exit(0);
+        } else if (strcmp(arg, "--self-check") == 0) {
+            config.self_check = true;
+            continue;
+        }
+
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+        i++;
+
+        if (strcmp(arg, "--sessions") == 0) {
+            config.sessions = atoi(value);
+        } else if (strcmp(arg, "--threads") == 0) {
+            config.threads = atoi(value);
+        } else if (strcmp(arg, "--txns") == 0) {
+            config.txns = atoi(value);
+        } else if (strcmp(arg, "--max-ops") == 0) {
+            config.max_ops = atoi(value);
+        } else if (strcmp(arg, "--keys") == 0) {
+            config.keys = atoi(value);
+        } else if (strcmp(arg, "--read-only-pct") == 0) {
+            config.read_only_pct = atoi(value);
+        } else if (strcmp(arg, "--abort-pct") == 0) {
+            config.abort_pct = atoi(value);
+        } else if (strcmp(arg, "--mode") == 0) {
+            if (strcmp(value, "xid") == 0) {
+                config.mode = MVCC_MODE_XID;
+            } else if (strcmp(value, "ts") == 0) {
+                config.mode = MVCC_MODE_TIMESTAMP;
+            } else {
+                fprintf(stderr, "Unknown mode: %s\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--shards") == 0) {
+            config.shards = atoi(value);
+        } else if (strcmp(arg, "--vacuum-every") == 0) {
+            config.vacuum_every = atoi(value);
+        } else if (strcmp(arg, "--idle-timeout-us") == 0) {
+            config.idle_timeout_us = atoi(value);
+        } else if (strcmp(arg, "--seed") == 0) {
+            config.seed = strtoull(value, NULL, 10);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+
+    // Sanity checks (every session has to fit its version IDs, and every
+    // session needs a transaction slot)
+    int sessions = config.threads > 0 ? config.threads : config.sessions;
+    if (sessions < 1 || sessions > MAX_SESSIONS || sessions >= MAX_TRANSACTIONS ||
+        config.txns < 1 || config.max_ops < 1 ||
+        (int64_t)config.txns * config.max_ops > MAX_VERSIONS_PER_SESSION ||
+        config.keys < 1 || config.keys + DELETABLE_KEYS > MAX_TUPLES ||
+        config.read_only_pct < 0 || config.read_only_pct > 100 ||
+        config.abort_pct < 0 || config.abort_pct > 100 ||
+        config.shards < 1 || config.shards > MAX_TX_SHARDS ||
+        config.vacuum_every < 0 || config.idle_timeout_us < 0) {
+        fprintf(stderr, "Invalid configuration (see --help)\n");
+        return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if (!parse_args(argc, argv)) {
+        return 2;
+    }
+    if (config.self_check) {
+        return run_self_check() ? 0 : 1;
+    }
+
+    init_transaction_manager();
+    init_table();
+    set_tx_shard_count(config.shards);
+    set_mvcc_mode(config.mode);
+
+    // Every row starts with version key + 1 (see add_setup_txn())
+    int rows = config.keys + DELETABLE_KEYS;
+    Transaction* setup = begin_transaction();
+    for (int key = 0; key < rows; key++) {
+        insert_tuple(setup, key + 1);
+    }
+    commit_transaction(setup);
+
+    bool threaded = config.threads > 0;
+    int count = threaded ? config.threads : config.sessions;
+    Session* sessions = (Session*)calloc((size_t)count, sizeof(Session));
+    for (int i = 0; i < count; i++) {
+        sessions[i].id = i;
+        sessions[i].rng = config.seed * 0x9E3779B97F4A7C15ull + (uint64_t)i + 1;
+        sessions[i].savepoint = -1;
+    }
+
+    printf("mvcc_stress: %d %s, mode %s, %d shard%s, seed %lu\n", count,
+           threaded ? "threads" : "sessions",
+           config.mode == MVCC_MODE_XID ? "xid" : "ts", config.shards,
+           config.shards == 1 ? "" : "s", config.seed);
+    if (threaded && !run_threads(sessions, count)) {
+        fprintf(stderr, "Could not start %d threads\n", count + 1);
+        for (int i = 0; i < count; i++) {
+            free_history(&sessions[i].log);
+        }
+        free(sessions);
+        return 2;
+    }
+    if (!threaded) {
+        run_sessions(sessions, count);
+    }
+
+    // Put the history together and check it
+    History all = {0};
+    merge_histories(&all, sessions, count);
+    int committed = 0, reads = 0, writes = 0;
+    for (int t = 1; t < all.txn_count; t++) {
+        committed += all.txns[t].committed;
+    }
+    for (int i = 0; i < all.op_count; i++) {
+        reads += all.ops[i].kind == OP_READ;
+        writes += all.ops[i].kind == OP_WRITE || all.ops[i].kind == OP_DELETE;
+    }
+    printf("  %d transactions (%d committed, %d aborted), %d reads, %d writes\n",
+           all.txn_count - 1, committed, all.txn_count - 1 - committed,
+           reads, writes);
+    if (!threaded) {
+        printf("  history digest %016lx (same seed, same digest)\n",
+               history_digest(&all));
+    }
+
+    Report r = {0};
+    int edge_counts[3];
+    int anomalies = check_history(&all, rows, &r, edge_counts);
+    printf("  dependency graph: %d ww, %d wr, %d rw edges\n",
+           edge_counts[EDGE_WW], edge_counts[EDGE_WR], edge_counts[EDGE_RW]);
+    if (anomalies == 0) {
+        printf("  no anomalies\n");
+    } else {
+        printf("  ANOMALIES:");
+        for (int k = 0; k < ANOMALY_COUNT; k++) {
+            if (r.counts[k] > 0) {
+                printf(" %s x%d", anomaly_names[k], r.counts[k]);
+            }
+        }
+        printf("\n");
+    }
+
+    // Nothing may be left running
+    if (count_active_transactions() != 0) {
+        printf("  %d transactions still active!\n", count_active_transactions());
+        anomalies++;
+    }
+
+    for (int i = 0; i < count; i++) {
+        free_history(&sessions[i].log);
+    }
+    free(sessions);
+    free_history(&all);
+    truncate_table();
+    return anomalies == 0 ? 0 : 1;
+}
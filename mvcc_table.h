@@ -9,8 +9,11 @@
 
 #include "mvcc_types.h"
 #include "mvcc_visibility.h"
+#include "mvcc_epoch.h"
+#include "mvcc_row.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 // Maximum number of tuple versions we can store
 #define MAX_TUPLES 1000
@@ -20,10 +23,15 @@
 // ----------------------------------------------------------------------------
 // A table is just a collection of tuples (rows).
 // Each tuple might have multiple versions linked together.
+//
+// Many threads can use the table at once: readers never lock anything,
+// and writers "claim" a version by swapping its xmax from 0 to their XID.
 
 typedef struct {
-    Tuple* tuples[MAX_TUPLES];  // Array of pointers to tuple chains
-    int tuple_count;             // How many tuples do we have?
+    Tuple* _Atomic tuples[MAX_TUPLES];  // Array of pointers to tuple chains
+    _Atomic int tuple_count;            // How many tuples do we have?
+    atomic_flag vacuum_running;         // Only one vacuum at a time
+    Schema schema;                      // Columns (none = single-int rows)
 } Table;
 
 // Global table (just one for simplicity)
@@ -38,6 +46,24 @@ void init_table() {
     for (int i = 0; i < MAX_TUPLES; i++) {
         global_table.tuples[i] = NULL;
     }
+    atomic_flag_clear(&global_table.vacuum_running);
+    global_table.schema.column_count = 0;
+}
+
+// ----------------------------------------------------------------------------
+// CLAIM A VERSION
+// ----------------------------------------------------------------------------
+// Before we update or delete a version, we put our XID in its xmax.
+// This is done as one atomic swap (0 -> our XID), so if two writers
+// race for the same row, exactly one of them wins.
+bool claim_version(Transaction* tx, Tuple* version) {
+    TransactionId expected = INVALID_XID;
+    if (!atomic_compare_exchange_strong(&version->xmax, &expected,
+                                        tx->current_xid)) {
+        metrics_inc(METRIC_WRITE_CONFLICTS);
+        return false;
+    }
+    return true;
 }
 
 // ----------------------------------------------------------------------------
@@ -46,31 +72,71 @@ void init_table() {
 // Add a brand new row to the table.
 // This creates the FIRST version of this row.
 
-bool insert_tuple(Transaction* tx, int32_t data) {
+// `row` holds the columns (NULL for a single-int row). It belongs to the
+// new version from now on, even if the insert fails.
+bool do_insert_tuple(Transaction* tx, int32_t data, RowData* row) {
     // Check if table is full
     if (global_table.tuple_count >= MAX_TUPLES) {
+        free_row(row);
         return false;  // No more room!
     }
 
+    // Writing needs an XID (read-only transactions get one now)
+    if (!ensure_transaction_xid(tx)) {
+        free_row(row);
+        return false;
+    }
+
     // Create a new tuple
     Tuple* new_tuple = (Tuple*)malloc(sizeof(Tuple));
     if (!new_tuple) {
+        free_row(row);
         return false;  // Out of memory!
     }
 
     // Fill in the tuple's information
-    new_tuple->xmin = tx->xid;        // I created this!
+    new_tuple->xmin = tx->current_xid; // I created this!
     new_tuple->xmax = INVALID_XID;    // Not deleted yet
     new_tuple->data = data;           // The actual data
+    new_tuple->row = row;             // (or the columns)
+    new_tuple->hints = 0;             // Nothing known about xmin/xmax yet
+    new_tuple->begin_ts = TS_INFINITY;  // Not committed yet
+    new_tuple->end_ts = TS_INFINITY;    // Not deleted
     new_tuple->next_version = NULL;   // No older versions yet
 
+    // Reserve a row number (other threads may be inserting too)
+    int index = global_table.tuple_count;
+    do {
+        if (index >= MAX_TUPLES) {
+            free_version(new_tuple);
+            return false;  // Someone else took the last spot
+        }
+    } while (!atomic_compare_exchange_weak(&global_table.tuple_count,
+                                           &index, index + 1));
+
+    // Write it in our diary so commit/abort can find it
+    Tuple* _Atomic* chain_head = &global_table.tuples[index];
+    if (!record_write(tx, WRITE_CREATED, new_tuple, chain_head)) {
+        free_version(new_tuple);
+        return false;  // (The row number stays empty)
+    }
+
     // Add it to the table
-    global_table.tuples[global_table.tuple_count] = new_tuple;
-    global_table.tuple_count++;
+    *chain_head = new_tuple;
 
     return true;
 }
 
+// (Only for tables without a schema - see insert_row())
+bool insert_tuple(Transaction* tx, int32_t data) {
+    if (global_table.schema.column_count > 0 || !enter_transaction(tx)) {
+        return false;  // Wrong kind of table, or terminated while idle
+    }
+    bool ok = do_insert_tuple(tx, data, NULL);
+    exit_transaction(tx);
+    return ok;
+}
+
 // ----------------------------------------------------------------------------
 // DELETE A ROW
 // ----------------------------------------------------------------------------
@@ -78,98 +144,349 @@ bool insert_tuple(Transaction* tx, int32_t data) {
 // We just mark it as deleted by setting xmax.
 // Other transactions might still need to see the old version.
 
-bool delete_tuple(Transaction* tx, int tuple_index) {
+bool do_delete_tuple(Transaction* tx, int tuple_index) {
     // Check if index is valid
     if (tuple_index < 0 || tuple_index >= global_table.tuple_count) {
         return false;
     }
 
+    // Keep vacuum from freeing the version while we look at it
+    epoch_enter();
     Tuple* tuple = global_table.tuples[tuple_index];
 
     // Find the version we can see
     Tuple* visible = get_visible_version(tx, tuple);
     if (!visible) {
+        epoch_exit();
         return false;  // We can't see any version, so we can't delete it!
     }
 
     // Check if already deleted
-    if (visible->xmax != INVALID_XID) {
-        return false;  // Already deleted by someone
+    if (visible->xmax != INVALID_XID || !ensure_transaction_xid(tx)) {
+        epoch_exit();
+        return false;  // Already deleted by someone (or out of XIDs)
     }
 
-    // Mark it as deleted by us
-    visible->xmax = tx->xid;
+    // Mark it as deleted by us (and remember it, in case we abort)
+    if (!claim_version(tx, visible)) {
+        epoch_exit();
+        return false;  // Someone deleted it a moment ago
+    }
+    if (!record_write(tx, WRITE_STAMPED, visible,
+                      &global_table.tuples[tuple_index])) {
+        visible->xmax = INVALID_XID;  // Let it go again
+        epoch_exit();
+        return false;
+    }
+    epoch_exit();
     return true;
 }
 
+bool delete_tuple(Transaction* tx, int tuple_index) {
+    if (!enter_transaction(tx)) {
+        return false;
+    }
+    bool ok = do_delete_tuple(tx, tuple_index);
+    exit_transaction(tx);
+    return ok;
+}
+
 // ----------------------------------------------------------------------------
 // UPDATE A ROW
 // ----------------------------------------------------------------------------
 // Update = Delete old version + Insert new version
 // The old version stays around for transactions that started earlier!
 // This is why MVCC is so powerful - no blocking!
-
-bool update_tuple(Transaction* tx, int tuple_index, int32_t new_data) {
+//
+// For a row with columns, `changed` has the new value of each column that
+// changes (NULL = keep it), and new_data is ignored. Usually the new
+// version stores just those columns; the rest are read from the versions
+// below it (see mvcc_row.h).
+
+bool do_update_tuple(Transaction* tx, int tuple_index, int32_t new_data,
+                     const Value* const* changed) {
     // Check if index is valid
     if (tuple_index < 0 || tuple_index >= global_table.tuple_count) {
         return false;
     }
 
+    // Keep vacuum from freeing the version while we look at it
+    epoch_enter();
     Tuple* old_tuple = global_table.tuples[tuple_index];
 
     // Find the version we can see
     Tuple* visible = get_visible_version(tx, old_tuple);
     if (!visible) {
+        epoch_exit();
         return false;  // We can't see any version!
     }
 
     // Check if already updated/deleted
-    if (visible->xmax != INVALID_XID) {
-        return false;  // Someone else got here first
+    if (visible->xmax != INVALID_XID || !ensure_transaction_xid(tx)) {
+        epoch_exit();
+        return false;  // Someone else got here first (or out of XIDs)
     }
 
     // Create a NEW version of this tuple
     Tuple* new_version = (Tuple*)malloc(sizeof(Tuple));
     if (!new_version) {
+        epoch_exit();
         return false;  // Out of memory
     }
+    new_version->row = NULL;
+
+    // Build its columns from the old ones
+    if (changed) {
+        new_version->row = visible->row
+            ? assemble_row(&global_table.schema, visible, changed)
+            : NULL;
+        if (!new_version->row) {
+            free(new_version);
+            epoch_exit();
+            return false;  // Out of memory (or no columns to change)
+        }
+    }
+
+    // Claim the old version. If we win, nobody else can add a version to
+    // this chain until we finish, so the version we see is the head.
+    if (!claim_version(tx, visible)) {
+        free_version(new_version);
+        epoch_exit();
+        return false;  // Someone else got here a moment ago
+    }
 
     // Fill in the new version
-    new_version->xmin = tx->xid;        // I created this version
+    new_version->xmin = tx->current_xid; // I created this version
     new_version->xmax = INVALID_XID;    // Not deleted yet
-    new_version->data = new_data;       // The new data!
+    new_version->data = changed ? visible->data : new_data;  // The new data!
+    new_version->hints = 0;             // Nothing known yet
+    new_version->begin_ts = TS_INFINITY;
+    new_version->end_ts = TS_INFINITY;
     new_version->next_version = NULL;   // End of chain
 
-    // Mark the old version as "updated" (deleted by this transaction)
-    visible->xmax = tx->xid;
+    // Write both halves of the update in our diary
+    Tuple* _Atomic* chain_head = &global_table.tuples[tuple_index];
+    int saved_count = tx->write_set.count;
+    if (!record_write(tx, WRITE_STAMPED, visible, chain_head) ||
+        !record_write(tx, WRITE_CREATED, new_version, chain_head)) {
+        tx->write_set.count = saved_count;  // Forget the half we wrote
+        visible->xmax = INVALID_XID;
+        free_version(new_version);
+        epoch_exit();
+        return false;
+    }
+
+    // The old version is now marked as "updated" (deleted by this
+    // transaction) - that happened when we claimed it.
 
     // Link the new version at the HEAD of the chain
     // (Newer versions go at the front, like a stack)
-    new_version->next_version = old_tuple;
-    global_table.tuples[tuple_index] = new_version;
+    new_version->next_version = *chain_head;
+    *chain_head = new_version;
+
+    epoch_exit();
+    return true;
+}
+
+// (Only for tables without a schema - see update_columns())
+bool update_tuple(Transaction* tx, int tuple_index, int32_t new_data) {
+    if (global_table.schema.column_count > 0 || !enter_transaction(tx)) {
+        return false;
+    }
+    bool ok = do_update_tuple(tx, tuple_index, new_data, NULL);
+    exit_transaction(tx);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// READ ONE ROW
+// ----------------------------------------------------------------------------
+// Look up the version of one row that this transaction can see.
+// Returns false if there is no such row (or we can't see any version).
+bool read_tuple(Transaction* tx, int tuple_index, int32_t* data) {
+    if (tuple_index < 0 || tuple_index >= global_table.tuple_count ||
+        !enter_transaction(tx)) {
+        return false;
+    }
+
+    epoch_enter();
+    Tuple* visible = get_visible_version(tx, global_table.tuples[tuple_index]);
+    if (visible) {
+        *data = visible->data;
+    }
+    epoch_exit();
+    exit_transaction(tx);
+    return visible != NULL;
+}
+
+// ----------------------------------------------------------------------------
+// ROWS WITH COLUMNS
+// ----------------------------------------------------------------------------
+// Give the table a schema. Only allowed while the table is empty (see
+// truncate_table()), so every row in a table has the same columns.
+bool set_table_schema(const Column* columns, int column_count) {
+    if (column_count < 1 || column_count > MAX_COLUMNS ||
+        global_table.tuple_count > 0) {
+        return false;
+    }
+    for (int c = 0; c < column_count; c++) {
+        global_table.schema.columns[c] = columns[c];
+    }
+    global_table.schema.column_count = column_count;
+    return true;
+}
+
+// Insert a row: one value per column, in schema order
+bool insert_row(Transaction* tx, const Value* values) {
+    Schema* schema = &global_table.schema;
+    if (schema->column_count == 0 || !enter_transaction(tx)) {
+        return false;
+    }
+
+    const Value* changed[MAX_COLUMNS];
+    bool ok = true;
+    for (int c = 0; c < schema->column_count && ok; c++) {
+        ok = value_fits_column(schema, c, &values[c]);
+        changed[c] = &values[c];
+    }
+
+    RowData* row = ok ? assemble_row(schema, NULL, changed) : NULL;
+    ok = row && do_insert_tuple(tx, 0, row);
+    exit_transaction(tx);
+    return ok;
+}
+
+// Change some columns of a row; the others are carried over
+bool update_columns(Transaction* tx, int tuple_index, const int* columns,
+                    const Value* values, int count) {
+    Schema* schema = &global_table.schema;
+    if (schema->column_count == 0 || count < 1 || !enter_transaction(tx)) {
+        return false;
+    }
+
+    const Value* changed[MAX_COLUMNS] = {0};
+    bool ok = true;
+    for (int i = 0; i < count && ok; i++) {
+        ok = value_fits_column(schema, columns[i], &values[i]);
+        if (ok) {
+            changed[columns[i]] = &values[i];
+        }
+    }
+
+    ok = ok && do_update_tuple(tx, tuple_index, 0, changed);
+    exit_transaction(tx);
+    return ok;
+}
+
+// Read one column of the version this transaction can see.
+// Text is copied into `buffer` (see row_get_column()).
+bool read_column(Transaction* tx, int tuple_index, int column, Value* out,
+                 char* buffer, size_t buffer_size) {
+    if (tuple_index < 0 || tuple_index >= global_table.tuple_count ||
+        !enter_transaction(tx)) {
+        return false;
+    }
+
+    epoch_enter();
+    Tuple* visible = get_visible_version(tx, global_table.tuples[tuple_index]);
+    bool ok = visible && row_get_column(&global_table.schema, visible,
+                                        column, out, buffer, buffer_size);
+    epoch_exit();
+    exit_transaction(tx);
+    return ok;
+}
 
+// ----------------------------------------------------------------------------
+// EMPTY THE TABLE
+// ----------------------------------------------------------------------------
+// Throw away every row and version (like TRUNCATE). Only while no
+// transaction is running, so nobody can be looking at the rows. The
+// schema is forgotten too.
+bool truncate_table() {
+    if (atomic_flag_test_and_set(&global_table.vacuum_running)) {
+        return false;  // Vacuum is walking the chains right now
+    }
+    lock_all_shards();
+    if (count_active_transactions() > 0) {
+        unlock_all_shards();
+        atomic_flag_clear(&global_table.vacuum_running);
+        return false;
+    }
+
+    for (int i = 0; i < global_table.tuple_count; i++) {
+        Tuple* version = global_table.tuples[i];
+        global_table.tuples[i] = NULL;
+        while (version) {
+            Tuple* next = version->next_version;
+            epoch_retire(version, version_bytes(version), free_version);
+            version = next;
+        }
+    }
+    global_table.tuple_count = 0;
+    global_table.schema.column_count = 0;
+    unlock_all_shards();
+
+    epoch_collect();
+    atomic_flag_clear(&global_table.vacuum_running);
     return true;
 }
 
+// Print one version's columns (long text is cut short)
+void print_row(const Tuple* version) {
+    Schema* schema = &global_table.schema;
+    char text[24];
+    for (int c = 0; c < schema->column_count; c++) {
+        Value value;
+        const RowData* owner;
+        const ColumnSlot* slot = find_column(version, c, &owner);
+        if (!slot) {
+            continue;
+        }
+        row_get_column(schema, version, c, &value, text, sizeof(text));
+        printf("%s%s=", c > 0 ? ", " : "", schema->columns[c].name);
+        if (value.type != COL_TEXT) {
+            printf("%ld", (long)value.number);
+        } else if (value.length <= sizeof(text)) {
+            printf("'%.*s'", (int)value.length, value.text);
+        } else {
+            printf("'%.*s...' (%u bytes%s)", (int)sizeof(text), value.text,
+                   value.length,
+                   slot->storage == STORE_TOAST ? ", out of line" : "");
+        }
+    }
+}
+
 // ----------------------------------------------------------------------------
 // SELECT ALL ROWS (VISIBLE TO THIS TRANSACTION)
 // ----------------------------------------------------------------------------
 // Read all rows that this transaction is allowed to see
 void select_all(Transaction* tx) {
+    if (!enter_transaction(tx)) {
+        printf("\n=== SELECT * failed: transaction was terminated ===\n");
+        return;
+    }
     printf("\n=== SELECT * (Transaction %lu) ===\n", tx->xid);
     printf("Index | Data\n");
     printf("------|-----\n");
 
     int visible_count = 0;
+    epoch_enter();
     for (int i = 0; i < global_table.tuple_count; i++) {
         Tuple* tuple = global_table.tuples[i];
         Tuple* visible = get_visible_version(tx, tuple);
 
-        if (visible) {
+        if (visible && visible->row) {
+            printf("  %3d | ", i);
+            print_row(visible);
+            printf("\n");
+            visible_count++;
+        } else if (visible) {
             printf("  %3d | %4d\n", i, visible->data);
             visible_count++;
         }
     }
+    epoch_exit();
+    exit_transaction(tx);
 
     if (visible_count == 0) {
         printf("  (no rows visible)\n");
@@ -182,25 +499,151 @@ void select_all(Transaction* tx) {
 // ----------------------------------------------------------------------------
 // In a real database, we eventually need to clean up old tuple versions
 // that no transaction can see anymore. This is called "vacuuming".
-// (We'll keep this simple for now - just show the concept)
+//
+// For each chain (newest first) we find the first version that committed
+// before every running transaction started (the "horizon"):
+// - everybody sees that version or something newer, so everything OLDER
+//   than it is garbage
+// - if it was also deleted before the horizon, nobody sees it either
+// - if we keep it and it is a delta, we also keep the versions below it
+//   down to the nearest full one, since its other columns live there
+//
+// We cut the garbage off the chain, but readers might still be walking
+// over it, so it goes to limbo (see mvcc_epoch.h) instead of being freed.
+// Returns how many versions were removed; *total_versions gets the count
+// before removing anything.
+
+int vacuum_pass(int* total_versions) {
+    *total_versions = 0;
+    if (atomic_flag_test_and_set(&global_table.vacuum_running)) {
+        return 0;  // Someone else is already vacuuming
+    }
 
-void vacuum_table() {
-    // In a full implementation, this would:
-    // 1. Find tuple versions that no active transaction can see
-    // 2. Free the memory for those old versions
-    // 3. Compact the storage
+    uint64_t started = metrics_now_ns();
+    Timestamp horizon = get_vacuum_horizon();
+    int removed = 0;
+
+    epoch_enter();
+    for (int i = 0; i < global_table.tuple_count; i++) {
+        Tuple* _Atomic* link = &global_table.tuples[i];
+        Tuple* current;
+
+        // Skip the versions that are too new for somebody
+        while ((current = *link) != NULL && current->begin_ts > horizon) {
+            (*total_versions)++;
+            link = &current->next_version;
+        }
+        if (!current) {
+            continue;
+        }
+
+        // Keep it, unless it was deleted before everyone started
+        // (then nothing newer can be stacked on top of it)
+        if (current->end_ts > horizon) {
+            (*total_versions)++;
+            link = &current->next_version;
+
+            // ...along with what a delta needs to be read
+            while (current->row && current->row->delta_depth > 0 &&
+                   (current = *link) != NULL) {
+                (*total_versions)++;
+                link = &current->next_version;
+            }
+        }
+
+        // Everything from here down is invisible to everybody
+        Tuple* dead = *link;
+        if (dead) {
+            *link = NULL;
+        }
+        while (dead) {
+            Tuple* next = dead->next_version;
+            epoch_retire(dead, version_bytes(dead), free_version);
+            (*total_versions)++;
+            removed++;
+            dead = next;
+        }
+    }
+    epoch_exit();
 
-    // For educational purposes, we'll just count how many versions exist
-    int total_versions = 0;
+    // Free whatever no reader can be holding any more
+    epoch_collect();
+
+    metrics_inc(METRIC_VACUUM_PASSES);
+    metrics_add(METRIC_VERSIONS_REMOVED, (uint64_t)removed);
+    metrics_observe(HIST_VACUUM_NS, metrics_now_ns() - started);
+
+    atomic_flag_clear(&global_table.vacuum_running);
+    return removed;
+}
+
+// ----------------------------------------------------------------------------
+// VERSION CHAIN LENGTHS
+// ----------------------------------------------------------------------------
+// Every lookup walks a chain from the newest version down, so long chains
+// mean slow reads. Chains only get long when an old snapshot keeps vacuum
+// from cutting them (see get_cleanup_blockers()).
+typedef struct {
+    int rows;                   // Rows with at least one version
+    uint64_t versions;          // Versions in all chains
+    uint64_t bytes;             // Memory they own (shared TOAST not included)
+    int longest;                // Longest chain...
+    int longest_row;            // ...and which row it belongs to (-1 = none)
+    HistogramSnapshot lengths;  // How many chains of each length
+} ChainStats;
+
+// Walk every chain right now (no locks, just like a reader)
+void measure_chain_stats(ChainStats* stats) {
+    memset(stats, 0, sizeof(ChainStats));
+    stats->longest_row = -1;
+
+    epoch_enter();
     for (int i = 0; i < global_table.tuple_count; i++) {
-        Tuple* current = global_table.tuples[i];
-        while (current) {
-            total_versions++;
-            current = current->next_version;
+        int length = 0;
+        for (Tuple* t = global_table.tuples[i]; t; t = t->next_version) {
+            length++;
+            stats->bytes += version_bytes(t);
+        }
+        if (length == 0) {
+            continue;  // Empty row number (insert was rolled back)
+        }
+
+        stats->rows++;
+        stats->versions += (uint64_t)length;
+        stats->lengths.buckets[histogram_bucket((uint64_t)length)]++;
+        stats->lengths.count++;
+        stats->lengths.sum += (uint64_t)length;
+        if (length > stats->longest) {
+            stats->longest = length;
+            stats->longest_row = i;
         }
     }
+    epoch_exit();
+}
+
+// The p-th chain is at most this long: the top of its length bucket, but
+// never longer than the longest chain we actually saw
+int chain_length_percentile_le(const ChainStats* stats, double p) {
+    uint64_t limit = histogram_percentile(&stats->lengths, p);
+    return limit < (uint64_t)stats->longest ? (int)limit : stats->longest;
+}
+
+void vacuum_table() {
+    int total_versions;
+    int removed = vacuum_pass(&total_versions);
 
+    EpochStats stats;
+    get_epoch_stats(&stats);
     printf("VACUUM: %d total tuple versions in table\n", total_versions);
+    printf("VACUUM: removed %d dead versions (%lu still in limbo, %lu bytes)\n",
+           removed, stats.limbo_items, stats.limbo_bytes);
+
+    ChainStats chains;
+    measure_chain_stats(&chains);
+    if (chains.longest_row >= 0) {
+        printf("VACUUM: longest chain left is %d versions (row %d)\n",
+               chains.longest, chains.longest_row);
+    }
 }
 
 #endif
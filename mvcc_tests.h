@@ -186,7 +186,7 @@ void test_concurrent() {
     printf("Multiple transactions working together!\n\n");
 
     // Clear table for clean test
-    init_table();
+    truncate_table();
 
     // TX1 inserts 1
     Transaction* tx1 = begin_transaction();
@@ -229,4 +229,479 @@ void test_concurrent() {
     commit_transaction(tx4);
 }
 
+
+// ----------------------------------------------------------------------------
+// TEST 6: Abort Cleans Up After Itself
+// ----------------------------------------------------------------------------
+// An aborted transaction uses its write set to take back everything it did,
+// so nobody has to step over its dead versions later.
+void test_abort_cleanup() {
+    printf("\n");
+    printf("========================================\n");
+    printf("TEST 6: Abort Cleans Up After Itself\n");
+    printf("========================================\n");
+    printf("Aborted work is removed right away!\n\n");
+
+    printf("Before:\n");
+    vacuum_table();
+
+    // TX1 does a bunch of work...
+    Transaction* tx1 = begin_transaction();
+    update_tuple(tx1, 0, 111);
+    update_tuple(tx1, 0, 222);
+    delete_tuple(tx1, 1);
+    insert_tuple(tx1, 333);
+    printf("TX%lu: Updated row 0 twice, deleted row 1, inserted 333\n",
+           tx1->xid);
+    printf("TX%lu sees:\n", tx1->xid);
+    select_all(tx1);
+    vacuum_table();
+
+    // ...and then changes its mind. (Its slot is free again after the
+    // abort, so we remember its XID first.)
+    TransactionId aborted_xid = tx1->xid;
+    abort_transaction(tx1);
+    printf("TX%lu aborted (write set undone)\n", aborted_xid);
+    vacuum_table();
+
+    // Everything is back the way it was
+    Transaction* tx2 = begin_transaction();
+    printf("TX%lu sees (same as before TX%lu):\n", tx2->xid, aborted_xid);
+    select_all(tx2);
+    commit_transaction(tx2);
+}
+
+
+// ----------------------------------------------------------------------------
+// TEST 7: Savepoints
+// ----------------------------------------------------------------------------
+// Roll back part of a transaction without losing the rest
+void test_savepoints() {
+    printf("\n");
+    printf("========================================\n");
+    printf("TEST 7: Savepoints\n");
+    printf("========================================\n");
+    printf("Undo just the last part of a transaction!\n\n");
+
+    Transaction* tx1 = begin_transaction();
+    insert_tuple(tx1, 500);
+    printf("TX%lu: Inserted 500\n", tx1->xid);
+
+    // Bookmark, then do some work we'll regret
+    int sp = create_savepoint(tx1);
+    printf("TX%lu: SAVEPOINT (sub-XID %lu)\n", tx1->xid, tx1->current_xid);
+    update_tuple(tx1, 0, 999);
+    insert_tuple(tx1, 600);
+    printf("TX%lu: Updated row 0 -> 999, inserted 600\n", tx1->xid);
+
+    // Another transaction starts while the savepoint's sub-XID is running
+    Transaction* tx2 = begin_transaction();
+
+    printf("TX%lu sees:\n", tx1->xid);
+    select_all(tx1);
+
+    // Undo only the work after the bookmark
+    rollback_to_savepoint(tx1, sp);
+    printf("TX%lu: ROLLBACK TO SAVEPOINT\n", tx1->xid);
+    printf("TX%lu sees (500 is kept, 999 and 600 are gone):\n", tx1->xid);
+    select_all(tx1);
+
+    // Work after the rollback uses a fresh sub-XID and is kept
+    update_tuple(tx1, 1, 700);
+    release_savepoint(tx1, sp);
+    printf("TX%lu: Updated row 1 -> 700, RELEASE SAVEPOINT\n", tx1->xid);
+    commit_transaction(tx1);
+    printf("TX%lu committed\n", tx1->xid);
+
+    // TX2's snapshot had TX1 and its sub-XID as "still running"
+    printf("TX%lu sees (nothing from TX%lu - snapshot!):\n",
+           tx2->xid, tx1->xid);
+    select_all(tx2);
+    commit_transaction(tx2);
+
+    Transaction* tx3 = begin_transaction();
+    printf("NEW Transaction %lu sees:\n", tx3->xid);
+    select_all(tx3);
+    commit_transaction(tx3);
+
+    // A batch job with lots of savepoints. Snapshots only copy its first
+    // sub-XIDs; for the others they look up the parent instead.
+    Transaction* batch = begin_transaction();
+    for (int i = 0; i < 100; i++) {
+        create_savepoint(batch);
+    }
+    update_tuple(batch, 0, 555);
+    printf("\nTX%lu: 100 SAVEPOINTs, then updated row 0 -> 555 (sub-XID %lu)\n",
+           batch->xid, batch->current_xid);
+
+    // Somebody commits a write, so the next begin builds a new snapshot
+    // (until then, every begin shares the one built last)
+    Transaction* tx5 = begin_transaction();
+    insert_tuple(tx5, 650);
+    commit_transaction(tx5);
+    printf("TX%lu: Inserted 650 and committed\n", tx5->xid);
+
+    Transaction* tx4 = begin_transaction();
+    printf("TX%lu's snapshot lists %d running XIDs%s\n", tx4->xid,
+           tx4->snapshot->xip_count,
+           tx4->snapshot->suboverflowed ? " (the rest: ask for the parent)" : "");
+    commit_transaction(batch);
+    printf("TX%lu committed\n", batch->xid);
+    printf("TX%lu sees (no 555 - the parent of sub-XID %lu was running):\n",
+           tx4->xid, batch->current_xid);
+    select_all(tx4);
+    commit_transaction(tx4);
+}
+
+
+// ----------------------------------------------------------------------------
+// TEST 8: Read-Only Transactions
+// ----------------------------------------------------------------------------
+// Readers don't use up XIDs, and share a snapshot until someone commits
+void test_read_only() {
+    printf("\n");
+    printf("========================================\n");
+    printf("TEST 8: Read-Only Transactions\n");
+    printf("========================================\n");
+    printf("Just looking? No ticket needed!\n\n");
+
+    uint64_t xids_before = count_assigned_xids();
+
+    // Two readers in a row: no XIDs, and the second reuses the snapshot
+    Transaction* r1 = begin_read_only_transaction();
+    printf("Reader 1 started (XID %lu, snapshot up to %lu)\n",
+           r1->xid, r1->snapshot->xmax);
+    commit_transaction(r1);
+    Transaction* r2 = begin_read_only_transaction();
+    printf("Reader 2 started (XID %lu, snapshot up to %lu - reused)\n",
+           r2->xid, r2->snapshot->xmax);
+    select_all(r2);
+    commit_transaction(r2);
+    printf("XIDs used by 2 readers: %lu\n\n",
+           count_assigned_xids() - xids_before);
+
+    // A writer commits, so the next reader needs a fresh snapshot
+    Transaction* tx1 = begin_transaction();
+    insert_tuple(tx1, 800);
+    commit_transaction(tx1);
+    printf("TX%lu: Inserted 800 and committed\n", tx1->xid);
+
+    // A reader that changes its mind gets an XID on its first write
+    Transaction* r3 = begin_read_only_transaction();
+    printf("Reader 3 started (XID %lu, fresh snapshot sees 800)\n", r3->xid);
+    update_tuple(r3, 0, 10);
+    printf("Reader 3 wrote to row 0 and got XID %lu\n", r3->xid);
+    select_all(r3);
+    commit_transaction(r3);
+}
+
+
+// ----------------------------------------------------------------------------
+// TEST 9: Timestamp Mode
+// ----------------------------------------------------------------------------
+// The same snapshot isolation, but a snapshot is just one number
+void test_timestamp_mode() {
+    printf("\n");
+    printf("========================================\n");
+    printf("TEST 9: Timestamp Mode\n");
+    printf("========================================\n");
+    printf("Visible if begin_ts <= read_ts < end_ts!\n\n");
+
+    set_mvcc_mode(MVCC_MODE_TIMESTAMP);
+
+    // TX1 updates row 0 but doesn't commit yet
+    Transaction* tx1 = begin_transaction();
+    update_tuple(tx1, 0, 20);
+    printf("TX%lu: Updating row 0 -> 20\n", tx1->xid);
+
+    // TX2 only has a read timestamp
+    Transaction* tx2 = begin_read_only_transaction();
+    printf("Reader started at read_ts %lu\n", tx2->read_ts);
+
+    commit_transaction(tx1);
+    printf("TX%lu committed at timestamp %lu\n",
+           tx1->xid, tx_manager.last_commit_ts);
+
+    // The new version's begin_ts is after the reader's read_ts
+    printf("Reader sees (OLD value - its read_ts is older):\n");
+    select_all(tx2);
+    commit_transaction(tx2);
+
+    Transaction* tx3 = begin_read_only_transaction();
+    printf("New reader at read_ts %lu sees:\n", tx3->read_ts);
+    select_all(tx3);
+    commit_transaction(tx3);
+
+    set_mvcc_mode(MVCC_MODE_XID);
+
+    // The clock must keep moving forward for a long time. (Microseconds
+    // since 1970 shifted by 16 bits wrap to zero on 2032-06-08.)
+    struct timespec before_wrap = {.tv_sec = 1970324836 - 1, .tv_nsec = 0};
+    struct timespec after_wrap = {.tv_sec = 1970324836 + 1, .tv_nsec = 0};
+    Timestamp ts_before = hlc_next(0, hlc_physical_time(&before_wrap));
+    Timestamp ts_after = hlc_next(ts_before, hlc_physical_time(&after_wrap));
+    printf("\nClock check: June 2032 at %lu, two seconds later at %lu (%s)\n",
+           ts_before, ts_after,
+           ts_after - ts_before > 1 ? "still moving forward" : "STUCK");
+}
+
+// ----------------------------------------------------------------------------
+// TEST 10: Long Snapshots
+// ----------------------------------------------------------------------------
+// One forgotten reader keeps every version alive, and the chains grow
+void test_long_snapshots() {
+    printf("\n");
+    printf("========================================\n");
+    printf("TEST 10: Long Snapshots\n");
+    printf("========================================\n");
+    printf("An old snapshot holds vacuum back!\n\n");
+
+    // A reader starts... and then its owner wanders off
+    Transaction* old_reader = begin_read_only_transaction();
+    printf("Old reader started at read_ts %lu\n", old_reader->read_ts);
+
+    // Meanwhile row 0 is updated again and again
+    for (int i = 1; i <= 5; i++) {
+        Transaction* tx = begin_transaction();
+        update_tuple(tx, 0, i * 1000);
+        commit_transaction(tx);
+    }
+    printf("Row 0 updated 5 times\n");
+
+    vacuum_table();
+
+    // Who is holding cleanup back?
+    CleanupBlocker blockers[4];
+    int count = get_cleanup_blockers(blockers, 4);
+    printf("Transactions holding back cleanup: %d\n", count);
+    for (int i = 0; i < count && i < 4; i++) {
+        printf("  read_ts %lu, running %lu us, idle %lu us%s\n",
+               blockers[i].read_ts, blockers[i].age_ns / 1000,
+               blockers[i].idle_ns / 1000, blockers[i].busy ? " (busy)" : "");
+    }
+
+    // Anything idle that long gets terminated (0 = "any idle time at all")
+    int terminated = abort_idle_snapshots(0);
+    printf("Terminated %d idle old snapshot(s)\n", terminated);
+
+    vacuum_table();
+
+    // Its slot stays taken until the owner finds out, so no re-sharding yet
+    printf("Re-shard before the owner is back: %s\n",
+           set_tx_shard_count(2) ? "ALLOWED (slot would be freed twice)" : "refused");
+
+    // The owner comes back and finds out
+    int32_t value;
+    printf("Old reader reads row 0: %s\n",
+           read_tuple(old_reader, 0, &value) ? "ok" : "FAILED (terminated)");
+    printf("Old reader commit: %s\n",
+           commit_transaction(old_reader) ? "ok" : "FAILED (terminated)");
+}
+
+// ----------------------------------------------------------------------------
+// TEST 11: Rows with Columns
+// ----------------------------------------------------------------------------
+// Real rows have many columns, and some of them are BIG
+void test_wide_rows() {
+    printf("\n");
+    printf("========================================\n");
+    printf("TEST 11: Rows with Columns\n");
+    printf("========================================\n");
+    printf("Long text is stored on the side and shared!\n\n");
+
+    // Start over with an empty table that has a schema
+    truncate_table();
+    Column columns[] = {
+        {"id", COL_INT64},
+        {"name", COL_TEXT},
+        {"age", COL_INT32},
+        {"story", COL_TEXT},
+    };
+    set_table_schema(columns, 4);
+    printf("Table now has columns: id, name, age, story\n");
+
+    // One short story, one very long story
+    static char long_story[5000];
+    memset(long_story, 'z', sizeof(long_story));
+    Value alice[] = {
+        {.type = COL_INT64, .number = 1},
+        {.type = COL_TEXT, .text = "Alice", .length = 5},
+        {.type = COL_INT32, .number = 30},
+        {.type = COL_TEXT, .text = "Likes cats", .length = 10},
+    };
+    Value bob[] = {
+        {.type = COL_INT64, .number = 2},
+        {.type = COL_TEXT, .text = "Bob", .length = 3},
+        {.type = COL_INT32, .number = 40},
+        {.type = COL_TEXT, .text = long_story, .length = sizeof(long_story)},
+    };
+    Transaction* tx1 = begin_transaction();
+    insert_row(tx1, alice);
+    insert_row(tx1, bob);
+    commit_transaction(tx1);
+    printf("Inserted Alice and Bob (Bob's story is %zu bytes)\n",
+           sizeof(long_story));
+    printf("Out-of-line values: %lu (%lu bytes)\n",
+           toast_stats.values, toast_stats.bytes);
+
+    // A reader holds on to the old version
+    Transaction* reader = begin_read_only_transaction();
+
+    // Bob has a birthday: only the age changes
+    Transaction* tx2 = begin_transaction();
+    int age_column = 2;
+    Value new_age = {.type = COL_INT32, .number = 41};
+    update_columns(tx2, 1, &age_column, &new_age, 1);
+    commit_transaction(tx2);
+    Tuple* newest = global_table.tuples[1];
+    printf("TX%lu: Bob's age -> 41 (new version is %zu bytes)\n",
+           tx2->xid, version_bytes(newest));
+    printf("Out-of-line values: %lu (the story was not copied)\n",
+           toast_stats.values);
+
+    printf("Old reader still sees age 40:\n");
+    select_all(reader);
+    commit_transaction(reader);
+
+    Transaction* tx3 = begin_read_only_transaction();
+    char story[16];
+    Value value;
+    read_column(tx3, 1, 3, &value, story, sizeof(story));
+    printf("New reader: Bob's story starts with '%.*s' (%u bytes)\n",
+           (int)sizeof(story), value.text, value.length);
+    select_all(tx3);
+    commit_transaction(tx3);
+
+    vacuum_table();
+}
+
+// ----------------------------------------------------------------------------
+// TEST 12: UPDATES STORE ONLY WHAT CHANGED
+// ----------------------------------------------------------------------------
+// A wide row where only a small counter changes
+void test_delta_versions() {
+    printf("\n");
+    printf("========================================\n");
+    printf("TEST 12: Updates Store Only What Changed\n");
+    printf("========================================\n");
+    printf("A new version keeps just the changed column (a delta)!\n\n");
+
+    truncate_table();
+    Column columns[] = {
+        {"id", COL_INT64},
+        {"name", COL_TEXT},
+        {"visits", COL_INT32},
+        {"notes", COL_TEXT},
+    };
+    set_table_schema(columns, 4);
+
+    static char notes[200];
+    memset(notes, 'n', sizeof(notes));
+    Value carol[] = {
+        {.type = COL_INT64, .number = 3},
+        {.type = COL_TEXT, .text = "Carol", .length = 5},
+        {.type = COL_INT32, .number = 0},
+        {.type = COL_TEXT, .text = notes, .length = sizeof(notes)},
+    };
+    Transaction* tx1 = begin_transaction();
+    insert_row(tx1, carol);
+    commit_transaction(tx1);
+    printf("Inserted Carol: %zu bytes (a full version)\n",
+           version_bytes(global_table.tuples[0]));
+
+    // This reader should keep seeing 0 visits
+    Transaction* reader = begin_read_only_transaction();
+
+    // Carol visits ten times: one update each
+    int visits_column = 2;
+    for (int visit = 1; visit <= 10; visit++) {
+        Transaction* tx = begin_transaction();
+        Value visits = {.type = COL_INT32, .number = visit};
+        update_columns(tx, 0, &visits_column, &visits, 1);
+        commit_transaction(tx);
+
+        Tuple* newest = global_table.tuples[0];
+        printf("TX%lu: visits -> %d, new version is %zu bytes (%s)\n",
+               tx->xid, visit, version_bytes(newest),
+               newest->row->delta_depth == 0 ? "FULL" : "delta");
+    }
+    printf("(After %d deltas in a row a full version is stored again, so a\n",
+           DELTA_CHAIN_MAX);
+    printf(" reader never walks far to find a column)\n");
+
+    // Both readers rebuild their own version of the row
+    printf("Old reader still sees:\n");
+    select_all(reader);
+    Transaction* tx2 = begin_read_only_transaction();
+    char text[16];
+    Value value;
+    read_column(tx2, 0, 1, &value, text, sizeof(text));
+    printf("New reader: name is '%.*s' (found below the deltas)\n",
+           (int)value.length, value.text);
+    select_all(tx2);
+    commit_transaction(tx2);
+    commit_transaction(reader);
+
+    // Vacuum keeps the newest version - and, if it is a delta, the
+    // versions below it down to the nearest full one
+    vacuum_table();
+}
+
+// ----------------------------------------------------------------------------
+// TEST 13: SHARDED TRANSACTION MANAGER
+// ----------------------------------------------------------------------------
+// Two shards, each handing out XIDs from its own block
+void test_sharded_manager() {
+    printf("\n");
+    printf("========================================\n");
+    printf("TEST 13: Sharded Transaction Manager\n");
+    printf("========================================\n");
+    printf("Each shard hands out tickets from its own roll!\n\n");
+
+    truncate_table();
+    set_tx_shard_count(2);
+    printf("Manager now has %d shards\n", tx_manager.shard_count);
+
+    // A transaction on shard 1 takes a fresh block of XIDs
+    bind_thread_to_shard(1);
+    Transaction* tx1 = begin_transaction();
+    insert_tuple(tx1, 1);
+    commit_transaction(tx1);
+    printf("TX%lu (shard 1): Inserted 1 and committed\n", tx1->xid);
+
+    // Our reader's snapshot goes up to the end of what was handed out
+    bind_thread_to_shard(0);
+    Transaction* reader = begin_transaction();
+    printf("TX%lu (shard 0): Snapshot up to XID %lu", reader->xid,
+           reader->snapshot->xmax);
+    for (int i = 0; i < reader->snapshot->gap_count; i++) {
+        printf(", not handed out yet: %lu..%lu",
+               reader->snapshot->gaps[i].start, reader->snapshot->gaps[i].end - 1);
+    }
+    printf("\n");
+
+    // Shard 0 still has XIDs left BELOW that snapshot's end
+    Transaction* tx2 = begin_transaction();
+    insert_tuple(tx2, 2);
+    commit_transaction(tx2);
+    printf("TX%lu (shard 0): Inserted 2 and committed\n", tx2->xid);
+    printf("(XID %lu is older than %lu, but it was still unused when\n",
+           tx2->xid, reader->snapshot->xmax);
+    printf(" TX%lu started - so TX%lu must not see it)\n",
+           reader->xid, reader->xid);
+
+    printf("TX%lu sees:\n", reader->xid);
+    select_all(reader);
+    commit_transaction(reader);
+
+    Transaction* tx3 = begin_read_only_transaction();
+    printf("A new reader sees both:\n");
+    select_all(tx3);
+    commit_transaction(tx3);
+
+    // Back to one shard for whatever comes next
+    bind_thread_to_shard(-1);
+    set_tx_shard_count(1);
+}
+
 #endif
@@ -8,124 +8,1391 @@
 #define MVCC_TRANSACTION_MANAGER_H
 
 #include "mvcc_types.h"
+#include "mvcc_epoch.h"
+#include "mvcc_metrics.h"
+#include "mvcc_row.h"
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
+#include <time.h>
 
 // Maximum number of transactions that can run at once
 #define MAX_TRANSACTIONS 100
 
+// The status log stores one byte per XID, in pages that are created
+// the first time an XID on that page is handed out.
+#define STATUS_PAGE_XIDS 65536
+#define MAX_STATUS_PAGES 16384
+
+// A snapshot copies at most this many sub-XIDs of each running
+// transaction (like PostgreSQL's PGPROC_MAX_CACHED_SUBXIDS); the
+// parent log covers the rest (see get_parent_xid())
+#define MAX_CACHED_SUBXIDS 64
+
+// How many shards to use unless set_tx_shard_count() says otherwise
+#define DEFAULT_TX_SHARDS 1
+
+// ----------------------------------------------------------------------------
+// SHARD
+// ----------------------------------------------------------------------------
+// On a big server with several sockets, one set of books that every
+// begin and commit has to write to keeps bouncing between the sockets.
+// So the books are split into shards (one per socket works well), like
+// giving each table in the classroom its own helper:
+// - each shard has its own lock, its own free slots and its own block of
+//   XIDs, so begins, XIDs and commits on different shards don't meet
+// - a block of XIDs is one whole status page, so only that shard ever
+//   writes to the page - and the page is created by the shard's own
+//   thread, so the operating system puts its memory on that socket
+//   (first touch)
+// - each shard counts its own commits; whoever wants the total adds
+//   them up (see count_commits())
+// - a snapshot has to see every shard at one moment, so building one
+//   locks all of them (always in order) and merges what they have. That
+//   only happens after a commit that wrote something; until the next
+//   one, every begin shares the snapshot that was built last.
+//
+// Still shared by all shards: building a snapshot, and the commit lock
+// that hands out commit timestamps in order. Commits that write (and
+// the first begin after each of them) still meet there, and that cost
+// grows with the number of shards - one thread doing begin + update +
+// commit takes about 330 ns with 1 shard and 460 ns with 16. Building
+// snapshots without every shard's lock (and a clock that needs no
+// lock) would be a redesign of its own.
+typedef struct {
+    _Alignas(64) mtx_t lock;
+
+    // Slots that are free to use (a stack, so taking one is instant)
+    int free_slots[MAX_TRANSACTIONS];
+    int free_count;
+
+    // How many of this shard's transactions are active?
+    _Atomic int active_count;
+
+    // The XID block we hand out from: block_next up to block_end
+    TransactionId block_next;
+    TransactionId block_end;
+
+    // XIDs handed out so far (just for statistics)
+    _Atomic uint64_t xids_assigned;
+
+    // How many of this shard's transactions committed a write? Changed
+    // under the shard's lock, read by anyone.
+    _Atomic uint64_t commit_count;
+} TxShard;
+
 // ----------------------------------------------------------------------------
 // TRANSACTION MANAGER
 // ----------------------------------------------------------------------------
 // This is the "boss" that keeps track of all transactions
 typedef struct {
-    // Next transaction ID to hand out (increases by 1 each time)
-    TransactionId next_xid;
+    // The shards (see above). Only the first shard_count are used.
+    TxShard shards[MAX_TX_SHARDS];
+    int shard_count;
+
+    // Threads are spread over the shards in turn (see thread_shard())
+    _Atomic int next_thread_ticket;
+
+    // Start of the next XID block nobody has taken yet. Every XID from
+    // here on is "in the future" for any snapshot.
+    _Atomic TransactionId next_block;
 
     // Array storing info about all transactions
+    // (slot i belongs to shard i % shard_count)
     Transaction transactions[MAX_TRANSACTIONS];
 
-    // How many transactions are currently active?
-    int active_count;
+    // STATUS LOG: the final word on every XID ever handed out, like a
+    // big logbook. It lets a slot be reused as soon as a transaction ends.
+    // Readers look things up here without the lock, so it's atomic.
+    _Atomic uint8_t* _Atomic status_pages[MAX_STATUS_PAGES];
+
+    // PARENT LOG: the owning transaction of every sub-XID past the first
+    // MAX_CACHED_SUBXIDS of its transaction. Same pages as the status
+    // log, but only created once such a sub-XID lands on them.
+    _Atomic TransactionId* _Atomic parent_pages[MAX_STATUS_PAGES];
+
+    // Commits that wrote something take turns here to get a commit
+    // timestamp and stamp it on their versions, so timestamps are
+    // published in order. Nothing else ever waits on this lock.
+    _Alignas(64) mtx_t commit_lock;
+
+    // Timestamp of the newest commit. In timestamp mode this is the whole
+    // snapshot: a new transaction sees everything committed up to here.
+    _Atomic Timestamp last_commit_ts;
+
+    // Which visibility rules are we using?
+    MvccMode mode;
+
+    // The last snapshot we built (NULL = none). Until the next commit,
+    // read-only transactions just point to it. It is only replaced with
+    // every shard locked, so holding any one shard's lock is enough to
+    // read it.
+    _Alignas(64) Snapshot* cached_snapshot;
 
 } TransactionManager;
 
 // Global transaction manager (only one exists)
 TransactionManager tx_manager;
 
+// This thread's ticket (-1 = none yet); its shard is ticket % shard_count
+_Thread_local int tx_thread_ticket = -1;
+
+// ----------------------------------------------------------------------------
+// SPREAD THE SLOTS OVER THE SHARDS
+// ----------------------------------------------------------------------------
+// (Only while no transaction is running.)
+void assign_slots_to_shards() {
+    for (int s = 0; s < MAX_TX_SHARDS; s++) {
+        tx_manager.shards[s].free_count = 0;
+    }
+    for (int i = MAX_TRANSACTIONS - 1; i >= 0; i--) {
+        int s = i % tx_manager.shard_count;
+        TxShard* shard = &tx_manager.shards[s];
+        tx_manager.transactions[i].shard = s;
+        shard->free_slots[shard->free_count++] = i;
+    }
+}
+
 // ----------------------------------------------------------------------------
 // INITIALIZE THE TRANSACTION MANAGER
 // ----------------------------------------------------------------------------
 // Call this once at startup to set everything up
 void init_transaction_manager() {
-    tx_manager.next_xid = FIRST_NORMAL_XID;
-    tx_manager.active_count = 0;
+    init_epoch_manager();
+    init_metrics();
+    for (int s = 0; s < MAX_TX_SHARDS; s++) {
+        TxShard* shard = &tx_manager.shards[s];
+        mtx_init(&shard->lock, mtx_plain);
+        shard->active_count = 0;
+        shard->block_next = 0;
+        shard->block_end = 0;
+        shard->xids_assigned = 0;
+        shard->commit_count = 0;
+    }
+    tx_manager.shard_count = DEFAULT_TX_SHARDS;
+    tx_manager.next_thread_ticket = 0;
+    tx_manager.next_block = 0;
+    mtx_init(&tx_manager.commit_lock, mtx_plain);
+    tx_manager.cached_snapshot = NULL;
+    tx_manager.mode = MVCC_MODE_XID;
+    tx_manager.last_commit_ts = 0;
+    tx_thread_ticket = -1;
 
-    // Clear all transaction slots
+    // Clear all transaction slots (and put them on the shards' free stacks)
     for (int i = 0; i < MAX_TRANSACTIONS; i++) {
+        memset(&tx_manager.transactions[i], 0, sizeof(Transaction));
         tx_manager.transactions[i].xid = INVALID_XID;
         tx_manager.transactions[i].status = TX_ABORTED;
     }
+    assign_slots_to_shards();
 }
 
 // ----------------------------------------------------------------------------
-// START A NEW TRANSACTION
+// WHICH SHARD IS MINE?
 // ----------------------------------------------------------------------------
-// Like getting a ticket number at the DMV
-Transaction* begin_transaction() {
-    // Find an empty slot
-    int slot = -1;
+// Threads take turns, so N threads spread evenly over N shards. A server
+// that pins its threads to sockets should call bind_thread_to_shard()
+// with the socket number instead, so every socket has a shard to itself.
+int thread_shard() {
+    if (tx_thread_ticket < 0) {
+        tx_thread_ticket = atomic_fetch_add(&tx_manager.next_thread_ticket, 1);
+    }
+    return tx_thread_ticket % tx_manager.shard_count;
+}
+
+void bind_thread_to_shard(int shard) {
+    tx_thread_ticket = shard < 0 ? -1 : shard;
+}
+
+// ----------------------------------------------------------------------------
+// LOCK EVERY SHARD
+// ----------------------------------------------------------------------------
+// Always in the same order, so two threads doing this can't deadlock.
+// While we hold them all, nobody can begin, get an XID or commit.
+void lock_all_shards() {
+    for (int s = 0; s < tx_manager.shard_count; s++) {
+        mtx_lock(&tx_manager.shards[s].lock);
+    }
+}
+
+void unlock_all_shards() {
+    for (int s = tx_manager.shard_count - 1; s >= 0; s--) {
+        mtx_unlock(&tx_manager.shards[s].lock);
+    }
+}
+
+// How many transactions are active? (Exact while every shard is locked.)
+int count_active_transactions() {
+    int active = 0;
+    for (int s = 0; s < tx_manager.shard_count; s++) {
+        active += tx_manager.shards[s].active_count;
+    }
+    return active;
+}
+
+// Is every slot back on a free stack? A transaction terminated for idling
+// no longer counts as active, but it keeps its slot until its owner
+// commits or aborts. (Exact while every shard is locked.)
+bool all_slots_free() {
+    int free_slots = 0;
+    for (int s = 0; s < tx_manager.shard_count; s++) {
+        free_slots += tx_manager.shards[s].free_count;
+    }
+    return free_slots == MAX_TRANSACTIONS;
+}
+
+// How many transactions have committed a write? Only such a commit can
+// change what a new snapshot would see, so if this number hasn't moved,
+// an old snapshot is still as good as a brand new one. (Exact while
+// every shard is locked. Without the locks it can only be behind by
+// commits that haven't finished yet.)
+uint64_t count_commits() {
+    uint64_t commits = 0;
+    for (int s = 0; s < tx_manager.shard_count; s++) {
+        commits += tx_manager.shards[s].commit_count;
+    }
+    return commits;
+}
+
+// How many XIDs (and sub-XIDs) have been handed out?
+uint64_t count_assigned_xids() {
+    uint64_t assigned = 0;
+    for (int s = 0; s < MAX_TX_SHARDS; s++) {
+        assigned += tx_manager.shards[s].xids_assigned;
+    }
+    return assigned;
+}
+
+// ----------------------------------------------------------------------------
+// SHARE A SNAPSHOT
+// ----------------------------------------------------------------------------
+// A snapshot never changes once it is built, so any number of
+// transactions can point to the same one. Each of them (and the cache)
+// holds a reference, and whoever lets go last frees it.
+Snapshot* snapshot_acquire(Snapshot* snapshot) {
+    atomic_fetch_add_explicit(&snapshot->refs, 1, memory_order_relaxed);
+    return snapshot;
+}
+
+void snapshot_release(Snapshot* snapshot) {
+    if (snapshot && atomic_fetch_sub(&snapshot->refs, 1) == 1) {
+        free(snapshot);
+    }
+}
+
+// A transaction is done with its snapshot once it has ended
+void drop_snapshot(Transaction* tx) {
+    snapshot_release(tx->snapshot);
+    tx->snapshot = NULL;
+}
+
+// ----------------------------------------------------------------------------
+// CHOOSE THE NUMBER OF SHARDS
+// ----------------------------------------------------------------------------
+// Only while every slot is free (terminated transactions that were
+// never reaped still hold theirs) and no other thread is using the
+// manager (like right after init). Shards that are dropped just leave
+// the rest of their XID block unused.
+bool set_tx_shard_count(int count) {
+    if (count < 1 || count > MAX_TX_SHARDS) {
+        return false;
+    }
+    lock_all_shards();
+    bool idle = all_slots_free();
+    unlock_all_shards();
+    if (!idle) {
+        return false;
+    }
+
+    for (int s = count; s < MAX_TX_SHARDS; s++) {
+        tx_manager.shards[s].block_next = tx_manager.shards[s].block_end;
+        tx_manager.shards[0].commit_count += tx_manager.shards[s].commit_count;
+        tx_manager.shards[s].commit_count = 0;  // Keep the total right
+    }
+    tx_manager.shard_count = count;
+    snapshot_release(tx_manager.cached_snapshot);  // It has the old gaps
+    tx_manager.cached_snapshot = NULL;
+    assign_slots_to_shards();
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// CHOOSE THE MVCC MODE
+// ----------------------------------------------------------------------------
+// Every commit stamps timestamps (and hint bits), so committed data reads
+// the same in both modes. We only switch while nobody is running.
+bool set_mvcc_mode(MvccMode mode) {
+    lock_all_shards();
+    bool idle = count_active_transactions() == 0;
+    if (idle) {
+        tx_manager.mode = mode;
+    }
+    unlock_all_shards();
+    return idle;
+}
+
+// ----------------------------------------------------------------------------
+// HYBRID LOGICAL CLOCK
+// ----------------------------------------------------------------------------
+// Commit timestamps follow the wall clock (microseconds, shifted left to
+// leave room for a counter), but never go backwards and never repeat:
+// if the clock hasn't moved, we just add 1 to the last timestamp.
+//
+// The microseconds count from 2020, not 1970, and the counter gets 12
+// bits: that fits in 64 bits until about 2162. (Microseconds since 1970
+// shifted by 16 don't fit at all - the top bits fall off, and the clock
+// jumps back to zero every 8.9 years.)
+#define HLC_EPOCH_SECONDS 1577836800  // 2020-01-01 00:00:00 UTC
+#define HLC_LOGICAL_BITS 12
+
+Timestamp hlc_physical_time(const struct timespec* now) {
+    if (now->tv_sec < HLC_EPOCH_SECONDS) {
+        return 0;  // Clock set way back: the counter carries us forward
+    }
+    Timestamp micros = (Timestamp)(now->tv_sec - HLC_EPOCH_SECONDS) * 1000000 +
+                       (Timestamp)now->tv_nsec / 1000;
+    return micros << HLC_LOGICAL_BITS;
+}
+
+// The timestamp that comes after `last` at physical time `physical`
+Timestamp hlc_next(Timestamp last, Timestamp physical) {
+    return physical > last ? physical : last + 1;
+}
+
+// (Caller holds tx_manager.commit_lock.)
+Timestamp next_commit_timestamp() {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return hlc_next(tx_manager.last_commit_ts, hlc_physical_time(&now));
+}
+
+// ----------------------------------------------------------------------------
+// STATUS LOG
+// ----------------------------------------------------------------------------
+// Write down what happened to an XID. Every XID comes from the block of
+// its transaction's shard, so the caller holds that shard's lock.
+void set_xid_status(TransactionId xid, TransactionStatus status) {
+    _Atomic uint8_t* statuses = tx_manager.status_pages[xid / STATUS_PAGE_XIDS];
+    statuses[xid % STATUS_PAGE_XIDS] = (uint8_t)status;
+}
+
+// Take the next block of XIDs for a shard: one whole status page.
+// We create the page right here, on the shard's own thread, so its
+// memory ends up next to the CPU that will write it. (Caller holds the
+// shard's lock.)
+bool claim_xid_block(TxShard* shard) {
+    TransactionId start = atomic_fetch_add(&tx_manager.next_block,
+                                           STATUS_PAGE_XIDS);
+    uint64_t page = start / STATUS_PAGE_XIDS;
+    if (page >= MAX_STATUS_PAGES) {
+        return false;  // We ran out of XIDs!
+    }
+    uint8_t* fresh = (uint8_t*)malloc(STATUS_PAGE_XIDS);
+    if (!fresh) {
+        return false;  // Out of memory (the block is lost)
+    }
+    memset(fresh, TX_ABORTED, STATUS_PAGE_XIDS);
+    tx_manager.status_pages[page] = (_Atomic uint8_t*)fresh;  // Publish it
+
+    shard->block_next = start < FIRST_NORMAL_XID ? FIRST_NORMAL_XID : start;
+    shard->block_end = start + STATUS_PAGE_XIDS;
+    return true;
+}
+
+// Hand out the next XID of a shard and log it as running
+// (caller holds the shard's lock)
+TransactionId assign_xid(TxShard* shard) {
+    if (shard->block_next == shard->block_end && !claim_xid_block(shard)) {
+        return INVALID_XID;
+    }
+    TransactionId xid = shard->block_next++;
+    set_xid_status(xid, TX_IN_PROGRESS);
+    atomic_store_explicit(&shard->xids_assigned,
+                          atomic_load_explicit(&shard->xids_assigned,
+                                               memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    return xid;
+}
+
+// ----------------------------------------------------------------------------
+// XID LIST HELPERS
+// ----------------------------------------------------------------------------
+// Add an XID to a list (growing it if needed)
+bool xid_list_add(XidList* list, TransactionId xid) {
+    if (list->count == list->capacity) {
+        int new_capacity = list->capacity ? list->capacity * 2 : 8;
+        TransactionId* grown = (TransactionId*)realloc(
+            list->xids, (size_t)new_capacity * sizeof(TransactionId));
+        if (!grown) {
+            return false;  // Out of memory
+        }
+        list->xids = grown;
+        list->capacity = new_capacity;
+    }
+    list->xids[list->count++] = xid;
+    return true;
+}
+
+// Is this XID in the list? (It has to be in ascending order: we look in
+// the middle and throw away the half it can't be in.)
+bool xid_list_contains_sorted(const XidList* list, TransactionId xid) {
+    int low = 0;
+    int high = list->count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (list->xids[mid] < xid) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < list->count && list->xids[low] == xid;
+}
+
+// ----------------------------------------------------------------------------
+// PARENT LOG
+// ----------------------------------------------------------------------------
+// A batch job with thousands of savepoints would make every snapshot
+// (and every lookup in one) thousands of XIDs long. So snapshots only
+// copy the first MAX_CACHED_SUBXIDS sub-XIDs of a transaction, and for
+// every sub-XID after that we write down who its parent is. A snapshot
+// that had to leave some out asks for the parent instead, and the parent
+// itself is always in the snapshot (PostgreSQL's pg_subtrans).
+// (Caller holds the lock of the shard the sub-XID came from.)
+bool set_parent_xid(TransactionId subxid, TransactionId parent) {
+    uint64_t page = subxid / STATUS_PAGE_XIDS;
+    _Atomic TransactionId* parents = tx_manager.parent_pages[page];
+    if (!parents) {
+        parents = (_Atomic TransactionId*)calloc(STATUS_PAGE_XIDS,
+                                                  sizeof(TransactionId));
+        if (!parents) {
+            return false;  // Out of memory
+        }
+        tx_manager.parent_pages[page] = parents;  // Publish it
+    }
+    parents[subxid % STATUS_PAGE_XIDS] = parent;
+    return true;
+}
+
+// The transaction a sub-XID belongs to (INVALID_XID = not written down)
+TransactionId get_parent_xid(TransactionId xid) {
+    uint64_t page = xid / STATUS_PAGE_XIDS;
+    if (page >= MAX_STATUS_PAGES) {
+        return INVALID_XID;
+    }
+    _Atomic TransactionId* parents = tx_manager.parent_pages[page];
+    return parents ? parents[xid % STATUS_PAGE_XIDS] : INVALID_XID;
+}
+
+// Hand out a sub-XID for a savepoint of tx and add it to tx's list,
+// writing down its parent if snapshots won't copy it.
+// (Caller holds the lock of tx's shard.)
+TransactionId assign_subxid(Transaction* tx) {
+    TxShard* shard = &tx_manager.shards[tx->shard];
+    TransactionId subxid = assign_xid(shard);
+    if (subxid == INVALID_XID) {
+        return INVALID_XID;
+    }
+    if ((tx->subxids.count >= MAX_CACHED_SUBXIDS &&
+         !set_parent_xid(subxid, tx->xid)) ||
+        !xid_list_add(&tx->subxids, subxid)) {
+        set_xid_status(subxid, TX_ABORTED);
+        return INVALID_XID;
+    }
+    return subxid;
+}
+
+// ----------------------------------------------------------------------------
+// IS THIS XID ONE OF MINE?
+// ----------------------------------------------------------------------------
+// A transaction owns its own XID plus every sub-XID from its savepoints
+// (except the ones that were rolled back - those are forgotten).
+// Sub-XIDs come from our shard's blocks, which only ever go up, so the
+// list is in order.
+bool is_my_xid(Transaction* tx, TransactionId xid) {
+    return xid != INVALID_XID &&
+           (xid == tx->xid || xid_list_contains_sorted(&tx->subxids, xid));
+}
+
+// ----------------------------------------------------------------------------
+// WAS THIS XID STILL RUNNING FOR MY SNAPSHOT?
+// ----------------------------------------------------------------------------
+// Either it was running when the snapshot was taken, or it sat in some
+// shard's block but wasn't handed out yet - so it started later.
+// If the snapshot left sub-XIDs out, a sub-XID that isn't listed was
+// running exactly when its parent was.
+bool snapshot_lists_xid(const Snapshot* snapshot, TransactionId xid) {
+    for (int i = 0; i < snapshot->xip_count; i++) {
+        if (snapshot->xip[i] == xid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool snapshot_xid_in_progress(Transaction* tx, TransactionId xid) {
+#ifdef MVCC_INJECT_FAULT
+    // A deliberately broken engine for "make test": snapshots forget who
+    // was running, so the stress tester has something it must catch
+    (void)tx;
+    (void)xid;
+    return false;
+#endif
+    const Snapshot* snapshot = tx->snapshot;
+    for (int i = 0; i < snapshot->gap_count; i++) {
+        if (xid >= snapshot->gaps[i].start && xid < snapshot->gaps[i].end) {
+            return true;
+        }
+    }
+    if (snapshot_lists_xid(snapshot, xid)) {
+        return true;
+    }
+    if (!snapshot->suboverflowed) {
+        return false;
+    }
+    TransactionId parent = get_parent_xid(xid);
+    return parent != INVALID_XID && snapshot_lists_xid(snapshot, parent);
+}
+
+// ----------------------------------------------------------------------------
+// TAKE A SNAPSHOT
+// ----------------------------------------------------------------------------
+// SNAPSHOT ISOLATION: What can a transaction see?
+// It can see all transactions that finished BEFORE it started.
+// xmin = oldest XID that might still be running
+// xmax = first XID that is "in the future"
+// xip  = everyone (and their first sub-XIDs) still running right now
+// gaps = the parts of shard blocks not handed out yet (also the future)
+// suboverflowed = somebody had more sub-XIDs than we copied
+// (Caller holds every shard's lock, so nobody starts or finishes meanwhile.)
+// Returns a new snapshot with one reference, or NULL if out of memory.
+Snapshot* build_snapshot() {
+    // Count who we'll write down, so the list fits in one allocation
+    int xip_count = 0;
     for (int i = 0; i < MAX_TRANSACTIONS; i++) {
-        if (tx_manager.transactions[i].xid == INVALID_XID) {
-            slot = i;
-            break;
+        Transaction* other = &tx_manager.transactions[i];
+        if (other->xid != INVALID_XID && other->status == TX_IN_PROGRESS) {
+            xip_count += 1 + (other->subxids.count < MAX_CACHED_SUBXIDS
+                                  ? other->subxids.count
+                                  : MAX_CACHED_SUBXIDS);
+        }
+    }
+    Snapshot* snapshot = (Snapshot*)malloc(
+        sizeof(Snapshot) + (size_t)xip_count * sizeof(TransactionId));
+    if (!snapshot) {
+        return NULL;  // Out of memory
+    }
+    snapshot->refs = 1;
+    snapshot->commits = count_commits();
+    snapshot->read_ts = tx_manager.last_commit_ts;
+    snapshot->xmax = tx_manager.next_block;
+    snapshot->gap_count = 0;
+    snapshot->suboverflowed = false;
+    snapshot->xip_count = 0;
+    XidRange* gaps = snapshot->gaps;
+
+    // The unused rest of every shard's block. A block that ends right at
+    // xmax just moves xmax down instead (with one shard, that's always
+    // the case: xmax is simply the next XID, and there are no gaps).
+    for (int s = 0; s < tx_manager.shard_count; s++) {
+        TxShard* shard = &tx_manager.shards[s];
+        if (shard->block_next < shard->block_end) {
+            gaps[snapshot->gap_count++] =
+                (XidRange){shard->block_next, shard->block_end};
+        }
+    }
+    bool moved = true;
+    while (moved) {
+        moved = false;
+        for (int i = 0; i < snapshot->gap_count; i++) {
+            if (gaps[i].end == snapshot->xmax) {
+                snapshot->xmax = gaps[i].start;
+                gaps[i] = gaps[--snapshot->gap_count];
+                moved = true;
+                break;
+            }
         }
     }
 
-    if (slot == -1) {
-        return NULL;  // No room! (all slots taken)
+    snapshot->xmin = snapshot->xmax;
+    for (int i = 0; i < snapshot->gap_count; i++) {
+        if (gaps[i].start < snapshot->xmin) {
+            snapshot->xmin = gaps[i].start;
+        }
+    }
+
+    // Find the oldest transaction that's still running, and write down
+    // all the running ones (with their savepoint sub-XIDs)
+    for (int i = 0; i < MAX_TRANSACTIONS; i++) {
+        Transaction* other = &tx_manager.transactions[i];
+        if (other->xid == INVALID_XID || other->status != TX_IN_PROGRESS) {
+            continue;  // Free slot, finished, or a reader without an XID
+        }
+        if (other->xid < snapshot->xmin) {
+            snapshot->xmin = other->xid;
+        }
+        snapshot->xip[snapshot->xip_count++] = other->xid;
+        int subxid_count = other->subxids.count;
+        if (subxid_count > MAX_CACHED_SUBXIDS) {
+            subxid_count = MAX_CACHED_SUBXIDS;
+            snapshot->suboverflowed = true;
+        }
+        for (int j = 0; j < subxid_count; j++) {
+            snapshot->xip[snapshot->xip_count++] = other->subxids.xids[j];
+        }
+    }
+    return snapshot;
+}
+
+// Keep a snapshot for the readers that come after us
+// (caller holds every shard's lock)
+void cache_snapshot(Snapshot* snapshot) {
+    snapshot_release(tx_manager.cached_snapshot);
+    tx_manager.cached_snapshot = snapshot_acquire(snapshot);
+}
+
+// ----------------------------------------------------------------------------
+// LOCK FOR A BEGIN
+// ----------------------------------------------------------------------------
+// A begin only needs its own shard - unless it has to build a snapshot
+// (or its shard is out of slots), then it needs all of them. We look at
+// our shard first, since the mode and the cached snapshot can't change
+// while we hold it. Returns true if every shard is now locked.
+bool snapshot_cache_fresh() {
+    return tx_manager.cached_snapshot &&
+           tx_manager.cached_snapshot->commits == count_commits();
+}
+
+bool lock_for_begin(int home) {
+    TxShard* shard = &tx_manager.shards[home];
+    mtx_lock(&shard->lock);
+    bool needs_snapshot = tx_manager.mode == MVCC_MODE_XID &&
+                          !snapshot_cache_fresh();
+    if (!needs_snapshot && shard->free_count > 0) {
+        return false;
+    }
+    mtx_unlock(&shard->lock);
+    lock_all_shards();
+    return true;
+}
+
+void unlock_after_begin(int home, bool all_locked) {
+    if (all_locked) {
+        unlock_all_shards();
+    } else {
+        mtx_unlock(&tx_manager.shards[home].lock);
     }
+}
 
-    // Create the new transaction
+// ----------------------------------------------------------------------------
+// GRAB A FREE SLOT
+// ----------------------------------------------------------------------------
+// From our own shard if we can; with every shard locked, from any shard.
+// (Caller holds the locks from lock_for_begin().)
+Transaction* take_slot(int home, bool all_locked) {
+    int tries = all_locked ? tx_manager.shard_count : 1;
+    TxShard* shard = NULL;
+    for (int i = 0; i < tries && !shard; i++) {
+        TxShard* candidate =
+            &tx_manager.shards[(home + i) % tx_manager.shard_count];
+        if (candidate->free_count > 0) {
+            shard = candidate;
+        }
+    }
+    if (!shard) {
+        return NULL;  // No room! (all slots taken)
+    }
+    int slot = shard->free_slots[--shard->free_count];
     Transaction* tx = &tx_manager.transactions[slot];
-    tx->xid = tx_manager.next_xid++;
+
+    tx->xid = INVALID_XID;
+    tx->current_xid = INVALID_XID;
+    tx->subxids.count = 0;
+    tx->savepoint_count = 0;
+    tx->write_set.count = 0;     // Fresh, empty diary (buffer is reused)
+    tx->activity = TX_IDLE;
+    tx->op_count = 0;
+    tx->seen_op_count = 0;
+    return tx;
+}
+
+// Stamp the start time on a fresh transaction. The clock is read before
+// taking the lock, so nobody waits on it.
+void set_begin_time(Transaction* tx, uint64_t now) {
+    tx->begin_ns = now;
+    tx->seen_since_ns = now;
+}
+
+// Give a slot back once its transaction is over. Its outcome lives on
+// in the status log, so nobody needs the slot any more.
+// (Caller holds the lock of the slot's shard.)
+void release_slot(Transaction* tx) {
+    TxShard* shard = &tx_manager.shards[tx->shard];
+    assert(shard->free_count < MAX_TRANSACTIONS);  // Never given back twice
+    shard->free_slots[shard->free_count++] =
+        (int)(tx - tx_manager.transactions);
+}
+
+// ----------------------------------------------------------------------------
+// POINT A TRANSACTION AT A SNAPSHOT
+// ----------------------------------------------------------------------------
+// If nobody has committed a write since the cached snapshot was built,
+// it is as good as a brand new one, so we just point to it - no copying.
+// An XID handed out after it was built lies in one of its gaps or past
+// its xmax, so to everyone sharing it, that transaction hasn't started
+// yet (and the transaction sees its own writes through is_my_xid()).
+// (Caller holds the locks from lock_for_begin(). With every shard locked
+// we build a new one: that is cheap next to taking all the locks, and
+// usually the reason we took them. Otherwise the cached one was fresh
+// when lock_for_begin() looked, and that is the moment we start at.)
+bool take_snapshot(Transaction* tx, bool all_locked) {
+    if (all_locked) {
+        tx->snapshot = build_snapshot();
+        if (!tx->snapshot) {
+            return false;
+        }
+        cache_snapshot(tx->snapshot);
+    } else {
+        tx->snapshot = snapshot_acquire(tx_manager.cached_snapshot);
+        metrics_inc(METRIC_SNAPSHOT_REUSED);
+    }
+
+    // Its read timestamp too, so vacuum keeps what this snapshot can see
+    tx->read_ts = tx->snapshot->read_ts;
+    return true;
+}
+
+// One more (or one less) active transaction in the slot's shard
+// (caller holds that shard's lock)
+void add_active(Transaction* tx, int delta) {
+    _Atomic int* active = &tx_manager.shards[tx->shard].active_count;
+    atomic_store_explicit(active,
+                          atomic_load_explicit(active, memory_order_relaxed) + delta,
+                          memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+// START A NEW TRANSACTION
+// ----------------------------------------------------------------------------
+// Like getting a ticket number at the DMV
+// (Caller holds the locks from lock_for_begin().)
+bool start_transaction(Transaction* tx, bool all_locked) {
+    // Create the new transaction (our XID comes from our shard's block)
+    tx->xid = assign_xid(&tx_manager.shards[tx->shard]);
+    if (tx->xid == INVALID_XID) {
+        return false;
+    }
+
+    // In timestamp mode the read timestamp is all we need.
+    // In XID mode we also need a snapshot. If we build a new one, we
+    // count as running in it, so the readers after us can share it.
+    tx->read_ts = tx_manager.last_commit_ts;
+    tx->snapshot = NULL;
     tx->status = TX_IN_PROGRESS;
+    if (tx_manager.mode == MVCC_MODE_XID && !take_snapshot(tx, all_locked)) {
+        tx->status = TX_ABORTED;
+        set_xid_status(tx->xid, TX_ABORTED);
+        tx->xid = INVALID_XID;
+        return false;
+    }
+    tx->current_xid = tx->xid;   // No savepoints yet: write with our own XID
+    return true;
+}
 
-    // SNAPSHOT ISOLATION: What can this transaction see?
-    // It can see all transactions that finished BEFORE it started.
-    // snapshot_xmin = oldest active transaction
-    // snapshot_xmax = this transaction's ID
+Transaction* begin_transaction() {
+    uint64_t started = metrics_now_ns();
+    int home = thread_shard();
+    bool all_locked = lock_for_begin(home);
+    Transaction* tx = take_slot(home, all_locked);
+    if (tx) {
+        set_begin_time(tx, started);
+        if (start_transaction(tx, all_locked)) {
+            add_active(tx, 1);
+        } else {
+            release_slot(tx);
+            tx = NULL;
+        }
+    }
+    unlock_after_begin(home, all_locked);
+
+    if (tx) {
+        metrics_inc(METRIC_TX_BEGIN);
+        if (metrics_should_sample(HIST_BEGIN_NS)) {
+            metrics_observe(HIST_BEGIN_NS, metrics_now_ns() - started);
+        }
+    }
+    return tx;
+}
 
-    tx->snapshot_xmin = tx->xid;  // Start with our own ID
-    tx->snapshot_xmax = tx->xid;
+// ----------------------------------------------------------------------------
+// START A READ-ONLY TRANSACTION (FAST PATH)
+// ----------------------------------------------------------------------------
+// Most transactions just look. A reader:
+// - does NOT get an XID (it will never be stamped on anything),
+//   unless it changes its mind and writes - then it gets one right then
+// - shares the cached snapshot, like every begin (see take_snapshot())
+// (Caller holds the locks from lock_for_begin().)
+bool start_read_only_transaction(Transaction* tx, bool all_locked) {
+    // Timestamp mode: the snapshot is just "everything committed so far"
+    // (XID mode points to a snapshot as well)
+    tx->read_ts = tx_manager.last_commit_ts;
+    tx->snapshot = NULL;
+    if (tx_manager.mode == MVCC_MODE_XID && !take_snapshot(tx, all_locked)) {
+        return false;
+    }
+    tx->status = TX_IN_PROGRESS;
+    return true;
+}
 
-    // Find the oldest transaction that's still running
-    for (int i = 0; i < MAX_TRANSACTIONS; i++) {
-        Transaction* other = &tx_manager.transactions[i];
-        if (other->xid != INVALID_XID &&
-            other->status == TX_IN_PROGRESS &&
-            other->xid < tx->snapshot_xmin) {
-            tx->snapshot_xmin = other->xid;
+Transaction* begin_read_only_transaction() {
+    uint64_t started = metrics_now_ns();
+    int home = thread_shard();
+    bool all_locked = lock_for_begin(home);
+    Transaction* tx = take_slot(home, all_locked);
+    if (tx) {
+        set_begin_time(tx, started);
+        if (start_read_only_transaction(tx, all_locked)) {
+            add_active(tx, 1);
+        } else {
+            release_slot(tx);
+            tx = NULL;
         }
     }
+    unlock_after_begin(home, all_locked);
 
-    tx_manager.active_count++;
+    if (tx) {
+        metrics_inc(METRIC_TX_BEGIN);
+        metrics_inc(METRIC_TX_BEGIN_READ_ONLY);
+        if (metrics_should_sample(HIST_BEGIN_NS)) {
+            metrics_observe(HIST_BEGIN_NS, metrics_now_ns() - started);
+        }
+    }
     return tx;
 }
 
+// ----------------------------------------------------------------------------
+// MAKE SURE WE HAVE AN XID
+// ----------------------------------------------------------------------------
+// Called before the first write. Read-only transactions get their XID
+// here, the first time they actually need one.
+bool ensure_transaction_xid(Transaction* tx) {
+    if (tx->xid != INVALID_XID) {
+        return true;
+    }
+    TxShard* shard = &tx_manager.shards[tx->shard];
+    mtx_lock(&shard->lock);
+    tx->xid = assign_xid(shard);
+    tx->current_xid = tx->xid;
+    mtx_unlock(&shard->lock);
+    return tx->xid != INVALID_XID;
+}
+
+// ----------------------------------------------------------------------------
+// ENTER / EXIT AN OPERATION
+// ----------------------------------------------------------------------------
+// The owner flips its transaction to "busy" for the length of every
+// operation. abort_idle_snapshots() may only terminate a transaction
+// that is idle, so it can never pull the rug out from under the owner.
+// Returns false if the transaction was terminated while idle.
+//
+// Reading the clock on every operation would cost more than a lookup,
+// so the owner only counts its operations. Whoever checks for idle
+// transactions notices when the count stops moving (see idle_ns()).
+bool enter_transaction(Transaction* tx) {
+    if (!tx) {
+        return false;
+    }
+    int expected = TX_IDLE;
+    return atomic_compare_exchange_strong(&tx->activity, &expected, TX_BUSY);
+}
+
+void exit_transaction(Transaction* tx) {
+    atomic_store_explicit(&tx->op_count,
+                          atomic_load_explicit(&tx->op_count, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&tx->activity, TX_IDLE, memory_order_release);
+}
+
+// How long has the owner left this transaction alone? Measured from the
+// first check that saw the current op_count, so it can be late by up
+// to the time between checks. (Caller holds every shard's lock.)
+uint64_t idle_ns(Transaction* tx, uint64_t now) {
+    uint64_t ops = tx->op_count;
+    if (ops != tx->seen_op_count || tx->activity == TX_BUSY) {
+        tx->seen_op_count = ops;
+        tx->seen_since_ns = now;
+        return 0;
+    }
+    return now > tx->seen_since_ns ? now - tx->seen_since_ns : 0;
+}
+
+// A terminated transaction keeps its slot until the owner finds out
+// (by calling commit or abort), so the owner's pointer stays valid.
+void reap_terminated_transaction(Transaction* tx) {
+    if (!tx || tx->activity != TX_TERMINATED) {
+        return;
+    }
+    TxShard* shard = &tx_manager.shards[tx->shard];
+    mtx_lock(&shard->lock);
+    int expected = TX_TERMINATED;
+    if (atomic_compare_exchange_strong(&tx->activity, &expected, TX_IDLE)) {
+        release_slot(tx);
+    }
+    mtx_unlock(&shard->lock);
+}
+
+// ----------------------------------------------------------------------------
+// REMEMBER A WRITE
+// ----------------------------------------------------------------------------
+// Called by the table every time this transaction creates or stamps a
+// version, so commit and abort know exactly where our work is.
+// Writes are stamped with tx->current_xid, so we remember that too.
+bool record_write(Transaction* tx, WriteKind kind, Tuple* tuple,
+                  Tuple* _Atomic* chain_head) {
+    WriteSet* ws = &tx->write_set;
+
+    // Out of room? Double the diary.
+    if (ws->count == ws->capacity) {
+        int new_capacity = ws->capacity ? ws->capacity * 2 : 16;
+        WriteEntry* grown = (WriteEntry*)realloc(
+            ws->entries, (size_t)new_capacity * sizeof(WriteEntry));
+        if (!grown) {
+            return false;  // Out of memory
+        }
+        ws->entries = grown;
+        ws->capacity = new_capacity;
+    }
+
+    ws->entries[ws->count].kind = kind;
+    ws->entries[ws->count].xid = tx->current_xid;
+    ws->entries[ws->count].tuple = tuple;
+    ws->entries[ws->count].chain_head = chain_head;
+    ws->count++;
+    if (kind == WRITE_CREATED) {
+        metrics_inc(METRIC_VERSIONS_CREATED);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// UNLINK A VERSION FROM ITS CHAIN
+// ----------------------------------------------------------------------------
+// Takes a version out of the chain (like pulling one bead off a string).
+// Our own versions are almost always at the head, so this is usually a
+// single step. A reader might be standing on the version right now, so
+// it goes to limbo instead of being freed on the spot.
+void unlink_version(Tuple* _Atomic* chain_head, Tuple* victim) {
+    Tuple* _Atomic* link = chain_head;
+    Tuple* current;
+    while ((current = *link) != NULL) {
+        if (current == victim) {
+            *link = victim->next_version;
+            // (If limbo can't take it, we leak it - better than a crash)
+            epoch_retire(victim, version_bytes(victim), free_version);
+            return;
+        }
+        link = &current->next_version;
+    }
+}
+
 // ----------------------------------------------------------------------------
 // COMMIT A TRANSACTION
 // ----------------------------------------------------------------------------
 // Save all changes permanently (like clicking "Save" in a video game)
-void commit_transaction(Transaction* tx) {
-    if (tx && tx->status == TX_IN_PROGRESS) {
-        tx->status = TX_COMMITTED;
-        tx_manager.active_count--;
+// Returns false if there was nothing to commit: the transaction was
+// already over, or it was terminated for idling (see abort_idle_snapshots).
+bool commit_transaction(Transaction* tx) {
+    if (!enter_transaction(tx)) {
+        reap_terminated_transaction(tx);
+        return false;
+    }
+    if (tx->status != TX_IN_PROGRESS) {
+        exit_transaction(tx);
+        return false;
+    }
+
+    uint64_t started =
+        metrics_should_sample(HIST_COMMIT_NS) ? metrics_now_ns() : 0;
+
+    // Everything below happens under our shard's lock. A new snapshot
+    // needs every shard's lock, so it sees all of this commit or none.
+    TxShard* shard = &tx_manager.shards[tx->shard];
+    mtx_lock(&shard->lock);
+
+    // Log the outcome
+    if (tx->xid != INVALID_XID) {
+        for (int i = 0; i < tx->subxids.count; i++) {
+            set_xid_status(tx->subxids.xids[i], TX_COMMITTED);
+        }
+        set_xid_status(tx->xid, TX_COMMITTED);
+    }
+    tx->status = TX_COMMITTED;
+    add_active(tx, -1);
+    drop_snapshot(tx);
+
+    // A transaction that wrote nothing (or rolled all of it back)
+    // changed nothing anyone can see, so it doesn't move the commit
+    // counter or the clock, and it never needs the commit lock: its
+    // commit stays inside its shard.
+    WriteSet* ws = &tx->write_set;
+    if (ws->count > 0) {
+        mtx_lock(&tx_manager.commit_lock);
+
+        // One pass over the write set: put "committed" stickers and our
+        // commit timestamp on every version we touched, so readers never
+        // need to look us up again.
+        Timestamp commit_ts = next_commit_timestamp();
+        for (int i = 0; i < ws->count; i++) {
+            WriteEntry* entry = &ws->entries[i];
+            if (entry->kind == WRITE_CREATED) {
+                entry->tuple->hints |= HINT_XMIN_COMMITTED;
+                entry->tuple->begin_ts = commit_ts;
+            } else if (entry->tuple->xmax == entry->xid) {
+                entry->tuple->hints |= HINT_XMAX_COMMITTED;
+                entry->tuple->end_ts = commit_ts;
+            }
+        }
+
+        // Count the commit BEFORE publishing its timestamp: a reader that
+        // still sees the old count may use the cached snapshot, and that
+        // snapshot's read timestamp must not be older than the horizon
+        // vacuum is using.
+        atomic_store_explicit(&shard->commit_count,
+                              atomic_load_explicit(&shard->commit_count,
+                                                   memory_order_relaxed) + 1,
+                              memory_order_seq_cst);
+
+        // Only now (with every version stamped) may new snapshots see us
+        tx_manager.last_commit_ts = commit_ts;
+        mtx_unlock(&tx_manager.commit_lock);
+    }
+    ws->count = 0;
+    tx->savepoint_count = 0;
+    tx->activity = TX_IDLE;
+    release_slot(tx);
+    mtx_unlock(&shard->lock);
+
+    metrics_inc(METRIC_TX_COMMIT);
+    if (started) {
+        metrics_observe(HIST_COMMIT_NS, metrics_now_ns() - started);
     }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// UNDO WRITES
+// ----------------------------------------------------------------------------
+// Take back every write after position `mark` in the write set.
+//
+// We walk the write set BACKWARDS (newest first), so if we updated the
+// same row twice, the second update is undone before the first one.
+// Afterwards there is no trace of that work left in any chain, so readers
+// don't have to step over our dead versions.
+void undo_writes(Transaction* tx, int mark) {
+    WriteSet* ws = &tx->write_set;
+    for (int i = ws->count - 1; i >= mark; i--) {
+        WriteEntry* entry = &ws->entries[i];
+        if (entry->kind == WRITE_CREATED) {
+            unlink_version(entry->chain_head, entry->tuple);
+        } else if (entry->tuple->xmax == entry->xid) {
+            entry->tuple->xmax = INVALID_XID;  // Un-delete it
+        }
+    }
+    ws->count = mark;
 }
 
 // ----------------------------------------------------------------------------
 // ABORT A TRANSACTION
 // ----------------------------------------------------------------------------
 // Throw away all changes (like clicking "Don't Save")
+// Mark an in-progress transaction (and its sub-XIDs) as aborted.
+// (Caller holds the lock of the transaction's shard and has already
+// undone the writes.)
+void mark_transaction_aborted(Transaction* tx) {
+    if (tx->xid != INVALID_XID) {
+        for (int i = 0; i < tx->subxids.count; i++) {
+            set_xid_status(tx->subxids.xids[i], TX_ABORTED);
+        }
+        set_xid_status(tx->xid, TX_ABORTED);
+    }
+    tx->status = TX_ABORTED;
+    add_active(tx, -1);
+    drop_snapshot(tx);
+    tx->savepoint_count = 0;
+}
+
 void abort_transaction(Transaction* tx) {
-    if (tx && tx->status == TX_IN_PROGRESS) {
-        tx->status = TX_ABORTED;
-        tx_manager.active_count--;
+    if (!enter_transaction(tx)) {
+        reap_terminated_transaction(tx);
+        return;
+    }
+    if (tx->status != TX_IN_PROGRESS) {
+        exit_transaction(tx);
+        return;
     }
+
+    undo_writes(tx, 0);  // No lock needed: these versions are ours
+
+    TxShard* shard = &tx_manager.shards[tx->shard];
+    mtx_lock(&shard->lock);
+    mark_transaction_aborted(tx);
+    tx->activity = TX_IDLE;
+    release_slot(tx);
+    mtx_unlock(&shard->lock);
+
+    metrics_inc(METRIC_TX_ABORT);
 }
 
 // ----------------------------------------------------------------------------
-// GET TRANSACTION STATUS
+// CREATE A SAVEPOINT
 // ----------------------------------------------------------------------------
-// Check if a transaction is done, running, or cancelled
-TransactionStatus get_transaction_status(TransactionId xid) {
+// Place a bookmark in the transaction. Everything written after this point
+// gets a brand new sub-XID, so it can be rolled back on its own.
+// Returns the savepoint number (use it to roll back or release), or -1.
+int do_create_savepoint(Transaction* tx) {
+    if (tx->status != TX_IN_PROGRESS || !ensure_transaction_xid(tx)) {
+        return -1;
+    }
+
+    // Make room on the savepoint stack
+    if (tx->savepoint_count == tx->savepoint_capacity) {
+        int new_capacity = tx->savepoint_capacity ? tx->savepoint_capacity * 2 : 4;
+        Savepoint* grown = (Savepoint*)realloc(
+            tx->savepoints, (size_t)new_capacity * sizeof(Savepoint));
+        if (!grown) {
+            return -1;  // Out of memory
+        }
+        tx->savepoints = grown;
+        tx->savepoint_capacity = new_capacity;
+    }
+
+    // Hand out a sub-XID from our shard's block, like normal XIDs.
+    // Snapshots read our sub-XID list, so we change it under the lock.
+    TxShard* shard = &tx_manager.shards[tx->shard];
+    mtx_lock(&shard->lock);
+    Savepoint* sp = &tx->savepoints[tx->savepoint_count];
+    sp->subxid_mark = tx->subxids.count;
+    sp->write_mark = tx->write_set.count;
+    sp->subxid = assign_subxid(tx);
+    mtx_unlock(&shard->lock);
+    if (sp->subxid == INVALID_XID) {
+        return -1;
+    }
+
+    tx->current_xid = sp->subxid;
+    return tx->savepoint_count++;
+}
+
+int create_savepoint(Transaction* tx) {
+    if (!enter_transaction(tx)) {
+        return -1;
+    }
+    int savepoint = do_create_savepoint(tx);
+    exit_transaction(tx);
+    return savepoint;
+}
+
+// ----------------------------------------------------------------------------
+// ROLL BACK TO A SAVEPOINT
+// ----------------------------------------------------------------------------
+// Undo only the work done after the bookmark. This costs as much as the
+// number of writes since the savepoint - the rest of the transaction is
+// not touched at all. The savepoint stays open so it can be used again.
+bool do_rollback_to_savepoint(Transaction* tx, int savepoint) {
+    if (tx->status != TX_IN_PROGRESS ||
+        savepoint < 0 || savepoint >= tx->savepoint_count) {
+        return false;
+    }
+
+    Savepoint* sp = &tx->savepoints[savepoint];
+    undo_writes(tx, sp->write_mark);
+    TxShard* shard = &tx_manager.shards[tx->shard];
+    mtx_lock(&shard->lock);
+
+    // The sub-XIDs of this savepoint and everything nested in it are
+    // aborted, and we forget them.
+    for (int i = sp->subxid_mark; i < tx->subxids.count; i++) {
+        set_xid_status(tx->subxids.xids[i], TX_ABORTED);
+    }
+    tx->subxids.count = sp->subxid_mark;
+    tx->savepoint_count = savepoint + 1;
+
+    // Start over inside the same savepoint with a fresh sub-XID
+    sp->subxid = assign_subxid(tx);
+    if (sp->subxid == INVALID_XID) {
+        // Out of XIDs (or memory): close the savepoint instead
+        tx->savepoint_count = savepoint;
+        tx->current_xid = savepoint > 0 ? tx->savepoints[savepoint - 1].subxid
+                                        : tx->xid;
+    } else {
+        tx->current_xid = sp->subxid;
+    }
+    mtx_unlock(&shard->lock);
+    metrics_inc(METRIC_SAVEPOINT_ROLLBACK);
+    return true;
+}
+
+bool rollback_to_savepoint(Transaction* tx, int savepoint) {
+    if (!enter_transaction(tx)) {
+        return false;
+    }
+    bool ok = do_rollback_to_savepoint(tx, savepoint);
+    exit_transaction(tx);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// RELEASE A SAVEPOINT
+// ----------------------------------------------------------------------------
+// Keep the work, drop the bookmark (and any bookmarks nested inside it).
+// The sub-XIDs stay ours, so their writes commit or abort with us.
+bool release_savepoint(Transaction* tx, int savepoint) {
+    if (!enter_transaction(tx)) {
+        return false;
+    }
+    bool ok = tx->status == TX_IN_PROGRESS &&
+              savepoint >= 0 && savepoint < tx->savepoint_count;
+    if (ok) {
+        tx->savepoint_count = savepoint;
+        tx->current_xid = savepoint > 0 ? tx->savepoints[savepoint - 1].subxid
+                                        : tx->xid;
+    }
+    exit_transaction(tx);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// VACUUM HORIZON
+// ----------------------------------------------------------------------------
+// The oldest read timestamp of any running transaction. A version that
+// committed at or before it is seen by EVERYONE (in both modes, since every
+// transaction started after that commit), so anything older than it is
+// garbage. If nobody is running, everything committed so far counts.
+Timestamp get_vacuum_horizon() {
+    lock_all_shards();
+    Timestamp horizon = tx_manager.last_commit_ts;
+    for (int i = 0; i < MAX_TRANSACTIONS; i++) {
+        Transaction* tx = &tx_manager.transactions[i];
+        if (tx->status == TX_IN_PROGRESS && tx->read_ts < horizon) {
+            horizon = tx->read_ts;
+        }
+    }
+    unlock_all_shards();
+    return horizon;
+}
+
+// ----------------------------------------------------------------------------
+// WHO IS HOLDING CLEANUP BACK?
+// ----------------------------------------------------------------------------
+// A running transaction whose read timestamp is older than the newest
+// commit keeps the versions it might still read alive - and with them
+// every newer version stacked on top. The oldest one IS the horizon.
+typedef struct {
+    TransactionId xid;     // INVALID_XID for a reader that never wrote
+    Timestamp read_ts;     // Its snapshot
+    uint64_t age_ns;       // How long it has been running
+    uint64_t idle_ns;      // How long since its owner last used it
+    bool busy;             // Is its owner inside an operation right now?
+} CleanupBlocker;
+
+// Fills `blockers` with up to max_blockers of them, oldest snapshot
+// first, and returns how many there are in total.
+int get_cleanup_blockers(CleanupBlocker* blockers, int max_blockers) {
+    lock_all_shards();
+    uint64_t now = metrics_now_ns();
+    int total = 0;
+    int kept = 0;
+
+    for (int i = 0; i < MAX_TRANSACTIONS; i++) {
+        Transaction* tx = &tx_manager.transactions[i];
+        if (tx->status != TX_IN_PROGRESS ||
+            tx->read_ts >= tx_manager.last_commit_ts) {
+            continue;  // Not running, or not holding anything back
+        }
+        total++;
+
+        CleanupBlocker blocker;
+        blocker.xid = tx->xid;
+        blocker.read_ts = tx->read_ts;
+        blocker.age_ns = now > tx->begin_ns ? now - tx->begin_ns : 0;
+        blocker.idle_ns = idle_ns(tx, now);
+        blocker.busy = tx->activity == TX_BUSY;
+
+        // Insert it in order (oldest snapshot first), keeping the best few
+        int pos = kept;
+        while (pos > 0 && blockers[pos - 1].read_ts > blocker.read_ts) {
+            if (pos < max_blockers) {
+                blockers[pos] = blockers[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < max_blockers) {
+            blockers[pos] = blocker;
+            if (kept < max_blockers) {
+                kept++;
+            }
+        }
+    }
+
+    unlock_all_shards();
+    return total;
+}
+
+// ----------------------------------------------------------------------------
+// TERMINATE IDLE OLD SNAPSHOTS
+// ----------------------------------------------------------------------------
+// Abort every transaction that holds cleanup back and whose owner hasn't
+// used it for idle_timeout_ns (like PostgreSQL's
+// idle_in_transaction_session_timeout). Its writes are undone right away
+// and its snapshot stops counting for the horizon. The owner finds out
+// on its next call: operations fail and commit returns false.
+// Returns how many transactions were terminated.
+int abort_idle_snapshots(uint64_t idle_timeout_ns) {
+    lock_all_shards();
+    uint64_t now = metrics_now_ns();
+    int terminated = 0;
+
     for (int i = 0; i < MAX_TRANSACTIONS; i++) {
-        if (tx_manager.transactions[i].xid == xid) {
-            return tx_manager.transactions[i].status;
+        Transaction* tx = &tx_manager.transactions[i];
+        if (tx->status != TX_IN_PROGRESS ||
+            tx->read_ts >= tx_manager.last_commit_ts ||
+            idle_ns(tx, now) < idle_timeout_ns) {
+            continue;
         }
+
+        // Only if the owner isn't using it right now (and won't start to)
+        int expected = TX_IDLE;
+        if (!atomic_compare_exchange_strong(&tx->activity, &expected,
+                                            TX_TERMINATED)) {
+            continue;
+        }
+        undo_writes(tx, 0);
+        mark_transaction_aborted(tx);
+        terminated++;
+    }
+
+    unlock_all_shards();
+    metrics_add(METRIC_SNAPSHOTS_TERMINATED, (uint64_t)terminated);
+    return terminated;
+}
+
+// ----------------------------------------------------------------------------
+// GET TRANSACTION STATUS
+// ----------------------------------------------------------------------------
+// Check if a transaction is done, running, or cancelled.
+// This is just a lookup in the status log (sub-XIDs have their own entry).
+// No lock: pages are published atomically and never move.
+TransactionStatus get_transaction_status(TransactionId xid) {
+    uint64_t page = xid / STATUS_PAGE_XIDS;
+    if (page >= MAX_STATUS_PAGES) {
+        return TX_ABORTED;  // Never handed out
+    }
+    _Atomic uint8_t* statuses = tx_manager.status_pages[page];
+    if (!statuses) {
+        return TX_ABORTED;
     }
-    return TX_ABORTED;  // If we can't find it, assume it's old and done
+    return (TransactionStatus)statuses[xid % STATUS_PAGE_XIDS];
 }
 
 #endif
@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 // ----------------------------------------------------------------------------
 // TRANSACTION ID (XID)
@@ -20,6 +21,26 @@ typedef uint64_t TransactionId;
 #define INVALID_XID 0       // This means "no transaction" (like ticket #0)
 #define FIRST_NORMAL_XID 1  // Real transactions start at 1
 
+// A run of XIDs from start up to (not including) end
+typedef struct {
+    TransactionId start;
+    TransactionId end;
+} XidRange;
+
+// The transaction manager can be split into this many shards at most
+// (see mvcc_transaction_manager.h)
+#define MAX_TX_SHARDS 16
+
+// ----------------------------------------------------------------------------
+// COMMIT TIMESTAMP
+// ----------------------------------------------------------------------------
+// When a transaction commits, it gets a timestamp from a clock that only
+// moves forward. Versions remember the timestamps of when they were born
+// and when they died, so "when did this happen?" is just a number compare.
+typedef uint64_t Timestamp;
+
+#define TS_INFINITY UINT64_MAX  // "Not yet" (not committed / not deleted)
+
 // ----------------------------------------------------------------------------
 // TUPLE (ROW) STRUCTURE
 // ----------------------------------------------------------------------------
@@ -28,22 +49,59 @@ typedef uint64_t TransactionId;
 //
 // Example: If you update a row, we don't delete the old version.
 // We create a NEW version and mark when it was created/deleted.
+//
+// Readers walk versions without taking any locks, so everything that can
+// change after a version is published is atomic.
 
 typedef struct Tuple {
     // Who created this version of the row?
     TransactionId xmin;  // "Transaction that INSERTED this row"
 
     // Who deleted/updated this version? (0 if still alive)
-    TransactionId xmax;  // "Transaction that DELETED this row"
+    // Writers claim a version by swapping 0 -> their xid here.
+    _Atomic TransactionId xmax;  // "Transaction that DELETED this row"
 
     // The actual data (we'll keep it simple: just one integer)
     int32_t data;
 
+    // ...or a whole row of columns, if the table has a schema
+    // (see mvcc_row.h; NULL for the classic single-int rows)
+    struct RowData* row;
+
+    // Hint bits: shortcuts so readers don't have to look up xmin/xmax status
+    _Atomic uint8_t hints;
+
+    // Commit timestamps of the creator and the deleter (TS_INFINITY = not yet)
+    _Atomic Timestamp begin_ts;
+    _Atomic Timestamp end_ts;
+
     // Link to next version of this row (like a chain of beads)
-    struct Tuple* next_version;
+    struct Tuple* _Atomic next_version;
 
 } Tuple;
 
+// ----------------------------------------------------------------------------
+// HINT BITS
+// ----------------------------------------------------------------------------
+// Once we KNOW the creator/deleter of a version committed, we write it down
+// on the version itself, like a "checked" sticker. Readers that see the
+// sticker don't have to go ask the transaction manager again.
+#define HINT_XMIN_COMMITTED 0x01  // The transaction in xmin committed
+#define HINT_XMAX_COMMITTED 0x02  // The transaction in xmax committed
+
+// ----------------------------------------------------------------------------
+// MVCC MODE
+// ----------------------------------------------------------------------------
+// Two ways to decide what a snapshot can see:
+// - XID mode (like PostgreSQL): a snapshot is a range of XIDs plus a list of
+//   who was still running, and readers ask about transaction status.
+// - Timestamp mode (like Hekaton or HyPer): a snapshot is one read timestamp,
+//   and a version is visible if begin_ts <= read_ts < end_ts.
+typedef enum {
+    MVCC_MODE_XID,
+    MVCC_MODE_TIMESTAMP
+} MvccMode;
+
 // ----------------------------------------------------------------------------
 // TRANSACTION STATUS
 // ----------------------------------------------------------------------------
@@ -54,6 +112,83 @@ typedef enum {
     TX_ABORTED       // Failed/cancelled (threw away the changes)
 } TransactionStatus;
 
+// Is the owner using the transaction right now? An idle transaction can
+// be terminated by someone else (see abort_idle_snapshots()).
+typedef enum {
+    TX_IDLE,         // Between operations (owner is busy elsewhere)
+    TX_BUSY,         // The owner is inside a table operation
+    TX_TERMINATED    // Aborted behind the owner's back
+} TransactionActivity;
+
+// ----------------------------------------------------------------------------
+// WRITE SET
+// ----------------------------------------------------------------------------
+// Every transaction keeps a little diary of what it touched:
+// - versions it CREATED (by insert or update)
+// - versions it STAMPED with its xid in xmax (by update or delete)
+// On abort we read the diary backwards to undo everything, and on commit
+// we read it once to put hint bits on all of our versions.
+typedef enum {
+    WRITE_CREATED,   // We made this version (it lives in a chain)
+    WRITE_STAMPED    // We set xmax on this version
+} WriteKind;
+
+typedef struct {
+    WriteKind kind;
+    TransactionId xid;   // The (sub)transaction ID we wrote with
+    Tuple* tuple;        // The version we created or stamped
+    Tuple* _Atomic* chain_head;  // Where the chain starts (to unlink versions)
+} WriteEntry;
+
+typedef struct {
+    WriteEntry* entries;  // Grows as needed
+    int count;
+    int capacity;
+} WriteSet;
+
+// ----------------------------------------------------------------------------
+// XID LIST
+// ----------------------------------------------------------------------------
+// A growable list of transaction IDs. Used for the sub-XIDs a transaction
+// owns and for the "who was still running" list in a snapshot.
+typedef struct {
+    TransactionId* xids;
+    int count;
+    int capacity;
+} XidList;
+
+// ----------------------------------------------------------------------------
+// SAVEPOINT
+// ----------------------------------------------------------------------------
+// A bookmark inside a transaction. Work done after the bookmark is written
+// with its own sub-transaction ID (sub-XID), so we can throw away just that
+// part without throwing away the whole transaction.
+typedef struct {
+    TransactionId subxid;  // The sub-XID used for writes after this bookmark
+    int write_mark;        // Write set size when the bookmark was placed
+    int subxid_mark;       // Sub-XID list size when the bookmark was placed
+} Savepoint;
+
+// ----------------------------------------------------------------------------
+// SNAPSHOT
+// ----------------------------------------------------------------------------
+// What a transaction can see in XID mode: a picture of who was running
+// when it started. A snapshot never changes after it is built, so every
+// transaction that starts before the next commit can share the same one
+// (see mvcc_transaction_manager.h).
+typedef struct Snapshot {
+    _Atomic int refs;              // How many transactions point to it
+    uint64_t commits;              // Commits so far when it was built
+    Timestamp read_ts;             // Newest commit timestamp back then
+    TransactionId xmin;            // Oldest transaction it can't see
+    TransactionId xmax;            // First XID that is "in the future"
+    XidRange gaps[MAX_TX_SHARDS];  // XIDs not handed out yet
+    int gap_count;
+    bool suboverflowed;            // Some sub-XIDs were left out of xip
+    int xip_count;
+    TransactionId xip[];           // Transactions still running back then
+} Snapshot;
+
 // ----------------------------------------------------------------------------
 // TRANSACTION INFO
 // ----------------------------------------------------------------------------
@@ -61,8 +196,20 @@ typedef enum {
 typedef struct Transaction {
     TransactionId xid;           // This transaction's ID number
     TransactionStatus status;    // Is it running, done, or cancelled?
-    TransactionId snapshot_xmin; // Oldest transaction I can see
-    TransactionId snapshot_xmax; // Newest transaction I can see
+    Snapshot* snapshot;          // XID mode: what I can see (maybe shared)
+    Timestamp read_ts;           // Timestamp mode: I see commits up to here
+    TransactionId current_xid;   // XID stamped on new writes (xid or sub-XID)
+    XidList subxids;             // Sub-XIDs that belong to me
+    Savepoint* savepoints;       // Stack of open savepoints
+    int savepoint_count;
+    int savepoint_capacity;
+    WriteSet write_set;          // Everything I created or stamped
+    int shard;                   // The manager shard my slot belongs to
+    uint64_t begin_ns;           // When I started
+    _Atomic int activity;        // A TransactionActivity
+    _Atomic uint64_t op_count;   // Operations my owner has finished
+    uint64_t seen_op_count;      // op_count the last time someone checked...
+    uint64_t seen_since_ns;      // ...and since when it hasn't moved
 } Transaction;
 
 #endif
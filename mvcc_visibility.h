@@ -11,6 +11,39 @@
 #include "mvcc_types.h"
 #include "mvcc_transaction_manager.h"
 
+// ----------------------------------------------------------------------------
+// IS THIS TUPLE VISIBLE TO ME? (TIMESTAMP MODE)
+// ----------------------------------------------------------------------------
+// In timestamp mode every committed version carries the commit timestamps
+// of its creator (begin_ts) and deleter (end_ts). A version is visible if
+// it was born at or before my read timestamp and died after it:
+//
+//     begin_ts <= read_ts < end_ts
+//
+// No status lookups and no "who was running" lists - just two compares.
+// Uncommitted timestamps are TS_INFINITY, so other people's unfinished
+// work is automatically "in the future". Only my OWN unfinished work
+// needs the xmin/xmax check.
+bool is_tuple_visible_ts(Transaction* tx, Tuple* tuple) {
+    // Did I create it? Then I see it, unless I deleted it too.
+    if (is_my_xid(tx, tuple->xmin)) {
+        return !is_my_xid(tx, tuple->xmax);
+    }
+
+    // Born after my read timestamp (or not committed at all)?
+    if (tuple->begin_ts > tx->read_ts) {
+        return false;
+    }
+
+    // Did I delete it myself?
+    if (is_my_xid(tx, tuple->xmax)) {
+        return false;
+    }
+
+    // Still alive at my read timestamp?
+    return tx->read_ts < tuple->end_ts;
+}
+
 // ----------------------------------------------------------------------------
 // IS THIS TUPLE VISIBLE TO ME?
 // ----------------------------------------------------------------------------
@@ -23,8 +56,14 @@
 //
 // It's like watching a movie - you can only see scenes that were filmed
 // before you started watching!
+//
+// (In timestamp mode we use the simpler rules above instead.)
 
 bool is_tuple_visible(Transaction* tx, Tuple* tuple) {
+    if (tx_manager.mode == MVCC_MODE_TIMESTAMP) {
+        return is_tuple_visible_ts(tx, tuple);
+    }
+
     TransactionId xmin = tuple->xmin;  // Who created this row?
     TransactionId xmax = tuple->xmax;  // Who deleted this row?
 
@@ -32,9 +71,10 @@ bool is_tuple_visible(Transaction* tx, Tuple* tuple) {
     // RULE 1: Was this row created by ME in this transaction?
     // ========================================================================
     // If I created it, I can definitely see it!
-    if (xmin == tx->xid) {
+    // ("Me" includes the sub-XIDs of my savepoints.)
+    if (is_my_xid(tx, xmin)) {
         // But wait - did I also delete it in this same transaction?
-        if (xmax == tx->xid) {
+        if (xmax != INVALID_XID && is_my_xid(tx, xmax)) {
             return false;  // I deleted it, so I shouldn't see it now
         }
         return true;  // I created it and haven't deleted it yet
@@ -45,7 +85,7 @@ bool is_tuple_visible(Transaction* tx, Tuple* tuple) {
     // ========================================================================
     // I can't see things that didn't exist when I began!
     // (Like you can't see a movie scene that wasn't filmed yet)
-    if (xmin >= tx->snapshot_xmax) {
+    if (xmin >= tx->snapshot->xmax) {
         return false;  // Too new! Created after my snapshot
     }
 
@@ -54,10 +94,15 @@ bool is_tuple_visible(Transaction* tx, Tuple* tuple) {
     // ========================================================================
     // If the transaction that created this row was still working when I began,
     // I don't know if they'll commit or abort, so I can't see it yet.
-    if (xmin >= tx->snapshot_xmin) {
-        TransactionStatus status = get_transaction_status(xmin);
-        if (status != TX_COMMITTED) {
-            return false;  // Creator didn't finish yet (or cancelled)
+    // Even if they commit later, my snapshot says they were still running.
+    // (If the "committed" hint bit is set, we don't need to ask the status.)
+    if (xmin >= tx->snapshot->xmin) {
+        if (snapshot_xid_in_progress(tx, xmin)) {
+            return false;  // Creator was still running when I started
+        }
+        if (!(tuple->hints & HINT_XMIN_COMMITTED) &&
+            get_transaction_status(xmin) != TX_COMMITTED) {
+            return false;  // Creator cancelled
         }
     }
 
@@ -72,7 +117,7 @@ bool is_tuple_visible(Transaction* tx, Tuple* tuple) {
     // ========================================================================
     // RULE 5: Did I delete this row myself?
     // ========================================================================
-    if (xmax == tx->xid) {
+    if (is_my_xid(tx, xmax)) {
         return false;  // I deleted it, so I shouldn't see it
     }
 
@@ -81,17 +126,20 @@ bool is_tuple_visible(Transaction* tx, Tuple* tuple) {
     // ========================================================================
     // If it was deleted after my snapshot, I should still see it
     // (I'm looking at an older version of the world)
-    if (xmax >= tx->snapshot_xmax) {
+    if (xmax >= tx->snapshot->xmax) {
         return true;  // Deleted in the future (relative to me)
     }
 
     // ========================================================================
     // RULE 7: Was the deleter transaction still running when I started?
     // ========================================================================
-    if (xmax >= tx->snapshot_xmin) {
-        TransactionStatus status = get_transaction_status(xmax);
-        if (status != TX_COMMITTED) {
-            return true;  // Deleter didn't finish, so row is still alive to me
+    if (xmax >= tx->snapshot->xmin) {
+        if (snapshot_xid_in_progress(tx, xmax)) {
+            return true;  // Deleter was still running when I started
+        }
+        if (!(tuple->hints & HINT_XMAX_COMMITTED) &&
+            get_transaction_status(xmax) != TX_COMMITTED) {
+            return true;  // Deleter cancelled, so row is still alive to me
         }
     }
 
@@ -107,22 +155,39 @@ bool is_tuple_visible(Transaction* tx, Tuple* tuple) {
 // This finds the RIGHT version for this transaction to see.
 //
 // It's like finding the right frame in a film strip!
+//
+// No locks here. Vacuum may be cutting old versions off this chain at the
+// same time, so call this between epoch_enter() and epoch_exit(), and only
+// use the version you got back until epoch_exit().
 
 Tuple* get_visible_version(Transaction* tx, Tuple* tuple) {
+    // Once in a while, time the whole walk (see mvcc_metrics.h)
+    uint64_t started =
+        metrics_should_sample(HIST_VISIBILITY_NS) ? metrics_now_ns() : 0;
+
     // Walk through the chain of versions
     Tuple* current = tuple;
+    uint64_t hops = 0;
 
     while (current != NULL) {
         // Is this version visible to me?
         if (is_tuple_visible(tx, current)) {
-            return current;  // Found it!
+            break;  // Found it!
         }
 
         // Try the next version
-        current = current->next_version;
+        current = atomic_load_explicit(&current->next_version,
+                                       memory_order_acquire);
+        hops++;
     }
 
-    return NULL;  // No visible version found
+    metrics_inc(METRIC_LOOKUPS);
+    metrics_add(METRIC_VISIBILITY_CHECKS, current ? hops + 1 : hops);
+    metrics_observe(HIST_CHAIN_HOPS, hops);
+    if (started) {
+        metrics_observe(HIST_VISIBILITY_NS, metrics_now_ns() - started);
+    }
+    return current;  // NULL if no visible version was found
 }
 
 #endif